@@ -5,11 +5,60 @@
 #include <float.h>
 #include <limits.h>
 #include <math.h> /* You may have to define _USE_MATH_DEFINES if you use MSVC */
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-/* This can be replaced by any BSD-like queue implementation. */
-#include <sys/queue.h>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#ifdef __APPLE__
+#include <dispatch/dispatch.h>
+#else
+#include <semaphore.h>
+#endif
+#endif
+
+/* The AVX2 and AVX-512 kernels are always compiled on x86 with compilers
+ * that allow per-function targets, and are only used if the CPU supports
+ * them. See ebur128_detect_simd_level. */
+#if defined(__SSE2__) || defined(_M_X64) || _M_IX86_FP >= 2
+#include <emmintrin.h>
+#define EBUR128_HAVE_SSE2
+#if defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER)
+#include <immintrin.h>
+#define EBUR128_HAVE_AVX2
+#define EBUR128_HAVE_AVX512
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+/* Contracting to FMA would make the results depend on the instruction set,
+ * of the kernels as well as of the portable code when the compiler targets
+ * a CPU with FMA. The build also passes -ffp-contract=off. */
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#elif defined(_MSC_VER)
+#pragma fp_contract(off)
+#endif
+
+#if defined(__clang__)
+#define EBUR128_TARGET(isa) __attribute__((target(isa)))
+#elif defined(__GNUC__)
+#define EBUR128_TARGET(isa)                                                    \
+  __attribute__((target(isa), optimize("fp-contract=off")))
+#else
+#define EBUR128_TARGET(isa)
+#endif
 
 #define CHECK_ERROR(condition, errorcode, goto_point)                          \
   if ((condition)) {                                                           \
@@ -17,6 +66,7 @@
     goto goto_point;                                                           \
   }
 #define EBUR128_MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define EBUR128_MIN(a, b) (((a) < (b)) ? (a) : (b))
 
 static int safe_size_mul(size_t nmemb, size_t size, size_t* result) {
   /* Adapted from OpenBSD reallocarray. */
@@ -30,44 +80,93 @@ static int safe_size_mul(size_t nmemb, size_t size, size_t* result) {
   return 0;
 }
 
-STAILQ_HEAD(ebur128_double_queue, ebur128_dq_entry);
-struct ebur128_dq_entry {
+/** Node of a treap ordered by energy. Nodes are referenced by their index in
+ *  the node pool, index 0 is the empty tree. */
+struct ebur128_tree_node {
   double z;
-  STAILQ_ENTRY(ebur128_dq_entry) entries;
+  /** Sum of z in this subtree. */
+  double sum;
+  /** Number of nodes in this subtree. */
+  size_t count;
+  size_t left;
+  size_t right;
+  unsigned long priority;
+};
+
+/** Block energies in sorted order, with sums and counts of each subtree so
+ *  that the gating thresholds can be applied in O(log n). */
+struct ebur128_tree {
+  struct ebur128_tree_node* nodes;
+  size_t capacity;
+  /** Index of the first node that has never been used. */
+  size_t used;
+  /** Nodes that were removed, linked through their "left" index. */
+  size_t free_list;
+  size_t root;
+  /** State of the pseudo random generator for node priorities. */
+  unsigned long seed;
+};
+
+/** Block energies, oldest first. Used as ring buffer that grows on demand
+ *  until it holds "max" entries, after which the oldest one is replaced. */
+struct ebur128_double_list {
+  double* z;
+  size_t capacity;
+  size_t start;
+  size_t size;
+  size_t max;
+  /** If set, all entries are also kept in "tree" (EBUR128_MODE_INCREMENTAL). */
+  int sorted;
+  struct ebur128_tree tree;
 };
 
 #define ALMOST_ZERO 0.000001
 #define FILTER_STATE_SIZE 5
+/* Blocks of a chunk that belong to short term blocks starting before it */
+#define EBUR128_HEAD_BLOCKS 29
 
-typedef struct {
-  unsigned int count;  /* Number of coefficients in this subfilter */
-  unsigned int* index; /* Delay index of corresponding filter coeff */
-  double* coeff;       /* List of subfilter coefficients */
-} interp_filter;
+/* Taps of the true peak interpolator (prefer odd to increase zero coeffs) */
+#define INTERP_TAPS 49
+/* Taps rounded up to a multiple of the largest interpolation factor (4) */
+#define INTERP_MAX_COEFFS ((INTERP_TAPS + 3) / 4 * 4)
+/* Size of the delay buffer for the smallest interpolation factor (2) */
+#define INTERP_MAX_DELAY ((INTERP_TAPS + 1) / 2)
 
-typedef struct {         /* Data structure for polyphase FIR interpolator */
+/* Data structure for polyphase FIR interpolator */
+typedef struct {
   unsigned int factor;   /* Interpolation factor of the interpolator */
-  unsigned int taps;     /* Taps (prefer odd to increase zero coeffs) */
   unsigned int channels; /* Number of channels */
   unsigned int delay;    /* Size of delay buffer */
-  interp_filter* filter; /* List of subfilters (one for each factor) */
-  float** z;             /* List of delay buffers (one for each channel) */
-  unsigned int zi;       /* Current delay buffer index */
+  /* Coefficients of all phases, coeff[d * factor + f] belongs to phase f
+   * and delay d. (Almost) zero coefficients are stored as 0.0. */
+  const double* coeff;
+  double gain;     /* Upper bound of the sum of |coeff| of a phase */
+  float** z;       /* Delay buffers (one for each channel, stored twice) */
+  unsigned int zi; /* Current delay buffer index */
 } interpolator;
 
 /** BS.1770 filter state. */
 typedef double filter_state[FILTER_STATE_SIZE];
 
 struct ebur128_state_internal {
-  /** Filtered audio data (used as ring buffer). */
-  double* audio_data;
-  /** Size of audio_data array. */
-  size_t audio_data_frames;
-  /** Current index for audio_data. */
-  size_t audio_data_index;
-  /** How many frames are needed for a gating block. Will correspond to 400ms
-   *  of audio at initialization, and 100ms after the first block (75% overlap
-   *  as specified in the 2011 revision of BS1770). */
+  /** Channel-weighted energy of each filtered frame (used as ring buffer).
+   *  Only needed for windows that do not start on a 100ms boundary. */
+  double* frame_energy;
+  /** Channel-weighted energy of each completed 100ms block (used as ring
+   *  buffer). The frames of block i are at frame_energy[i * samples_in_100ms].
+   */
+  double* subblock_energy;
+  /** Size of subblock_energy array. */
+  size_t subblocks;
+  /** Index of the 100ms block that is currently being filled. */
+  size_t subblock_index;
+  /** How many entries of subblock_energy hold audio, at most subblocks. A
+   *  gating block is calculated as soon as there are four of them (75%
+   *  overlap as specified in the 2011 revision of BS1770). */
+  size_t subblocks_filled;
+  /** Energy of the current 100ms block so far, one per channel. */
+  double* channel_energy;
+  /** How many frames are needed to complete the current 100ms block. */
   unsigned long needed_frames;
   /** The channel map. Has as many elements as there are channels. */
   int* channel_map;
@@ -79,19 +178,25 @@ struct ebur128_state_internal {
   double a[5];
   /** one filter_state per channel. */
   filter_state* v;
-  /** Linked list of block energies. */
-  struct ebur128_double_queue block_list;
-  unsigned long block_list_max;
-  unsigned long block_list_size;
-  /** Linked list of 3s-block energies, used to calculate LRA. */
-  struct ebur128_double_queue short_term_block_list;
-  unsigned long st_block_list_max;
-  unsigned long st_block_list_size;
+  /** List of block energies. */
+  struct ebur128_double_list block_list;
+  /** List of 3s-block energies, used to calculate LRA. */
+  struct ebur128_double_list short_term_block_list;
   int use_histogram;
   unsigned long* block_energy_histogram;
   unsigned long* short_term_block_energy_histogram;
   /** Keeps track of when a new short term block is needed. */
   size_t short_term_frame_counter;
+  /** Position of the first 100ms block in the stream, see
+   *  ebur128_start_chunk. */
+  unsigned long first_block;
+  /** Number of completed 100ms blocks. */
+  unsigned long blocks;
+  /** Energies of the first completed 100ms blocks. ebur128_merge needs them
+   *  for the gating and short term blocks that span two chunks. */
+  double head_energy[EBUR128_HEAD_BLOCKS];
+  /** Frames to be added before the chunk, see ebur128_start_chunk. */
+  size_t preroll;
   /** Maximum sample peak, one per channel */
   double* sample_peak;
   double* prev_sample_peak;
@@ -99,76 +204,214 @@ struct ebur128_state_internal {
   double* true_peak;
   double* prev_true_peak;
   interpolator* interp;
-  float* resampler_buffer_input;
-  size_t resampler_buffer_input_frames;
-  float* resampler_buffer_output;
-  size_t resampler_buffer_output_frames;
+  /** Worker threads, see ebur128_set_threads. NULL if single threaded. */
+  struct ebur128_pool* pool;
+  /** Number of streams whose channels follow each other in this state, see
+   *  ebur128_batch. Frame energies are summed per stream. */
+  unsigned int streams;
+  /** Channel groups that are filtered in parallel, see
+   *  ebur128_set_channel_parts. NULL if not used. */
+  struct ebur128_channel_parts* parts;
+  /** Interpolates the true peak on its own thread, see
+   *  ebur128_set_true_peak_worker. NULL if not used. */
+  struct ebur128_true_peak_worker* true_peak_worker;
+  /** Meter values for other threads, see ebur128_set_snapshot. NULL if not
+   *  used. */
+  struct ebur128_published_snapshot* snapshot;
+  /** Slot in shared memory that the same values are published to, see
+   *  ebur128_set_shared. NULL if not used. */
+  struct ebur128_published_snapshot* shared;
+  /** Called at the end of each 100ms block, see ebur128_set_block_callback.
+   *  NULL if not used. */
+  ebur128_block_callback block_callback;
+  void* block_user;
+  /** Peaks of the current 100ms block, one per channel. Only kept for the
+   *  block callback, NULL otherwise. */
+  double* block_sample_peak;
+  double* block_true_peak;
+  /** Momentary and short term loudness of the blocks, see
+   *  ebur128_set_timeline. NULL if not recorded. */
+  struct ebur128_timeline* timeline;
+  /** Block energies for windows beyond the maximum window, see
+   *  ebur128_set_max_long_window. NULL if not used. */
+  struct ebur128_long_window* long_window;
   /** The maximum window duration in ms. */
   unsigned long window;
   unsigned long history;
 };
 
-static double relative_gate = -10.0;
+static const double relative_gate = -10.0;
 
-/* Those will be calculated when initializing the library */
+/* Those will be calculated once, when the first state is initialized */
 static double relative_gate_factor;
 static double minus_twenty_decibels;
 static double histogram_energies[1000];
 static double histogram_energy_boundaries[1001];
+/* The interpolator coefficients only depend on the factor, so all states
+ * share them */
+static double interp_coeffs_x2[INTERP_MAX_COEFFS];
+static double interp_coeffs_x4[INTERP_MAX_COEFFS];
+static double interp_gain_x2;
+static double interp_gain_x4;
+static int simd_level;
+
+/* Fills in the coefficients and returns the gain of the loudest phase. */
+static double interp_init_coeffs(double* coeff, unsigned int factor) {
+  double gain = 0.0;
+  unsigned int j, f;
+
+  for (j = 0; j < INTERP_MAX_COEFFS; j++) {
+    coeff[j] = 0.0;
+  }
+  for (j = 0; j < INTERP_TAPS; j++) {
+    /* Calculate sinc */
+    double m = (double) j - (double) (INTERP_TAPS - 1) / 2.0;
+    double c = 1.0;
+    if (fabs(m) > ALMOST_ZERO) {
+      c = sin(m * M_PI / factor) / (m * M_PI / factor);
+    }
+    /* Apply Hanning window */
+    c *= 0.5 * (1 - cos(2 * M_PI * j / (INTERP_TAPS - 1)));
+
+    if (fabs(c) > ALMOST_ZERO) { /* Ignore any zero coeffs. */
+      /* Tap j belongs to phase j % factor and delay j / factor */
+      coeff[j] = c;
+    }
+  }
+  for (f = 0; f < factor; f++) {
+    double sum = 0.0;
+    for (j = f; j < INTERP_MAX_COEFFS; j += factor) {
+      sum += fabs(coeff[j]);
+    }
+    gain = EBUR128_MAX(gain, sum);
+  }
+  /* leave room for rounding the input and output to float */
+  return gain * (1.0 + 1e-6);
+}
+
+/* Returns the widest instruction set that is compiled in and supported by
+ * the CPU and the OS. */
+static int ebur128_detect_simd_level(void) {
+  int level = EBUR128_SIMD_NONE;
+#ifdef EBUR128_HAVE_SSE2
+  level = EBUR128_SIMD_SSE2;
+#if defined(EBUR128_HAVE_AVX2) && (defined(__GNUC__) || defined(__clang__))
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    level = EBUR128_SIMD_AVX2;
+  }
+  if (__builtin_cpu_supports("avx512f")) {
+    level = EBUR128_SIMD_AVX512;
+  }
+#elif defined(EBUR128_HAVE_AVX2) && defined(_MSC_VER)
+  {
+    int info[4];
+    unsigned long long xcr0;
+
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+      return level;
+    }
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 27))) { /* no OSXSAVE */
+      return level;
+    }
+    xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    if ((xcr0 & 0x06) == 0x06 && (info[1] & (1 << 5))) {
+      level = EBUR128_SIMD_AVX2;
+    }
+    if ((xcr0 & 0xe6) == 0xe6 && (info[1] & (1 << 16))) {
+      level = EBUR128_SIMD_AVX512;
+    }
+  }
+#endif
+#endif
+  return level;
+}
+
+/* The level can be lowered with the environment variable EBUR128_SIMD set to
+ * "none", "sse2", "avx2" or "avx512", e.g. to benchmark the kernels. */
+static int ebur128_select_simd_level(void) {
+  static const char* const names[] = { "none", "sse2", "avx2", "avx512" };
+  int level = ebur128_detect_simd_level();
+  const char* env = getenv("EBUR128_SIMD");
+  int i;
+
+  if (env) {
+    for (i = 0; i < (int) (sizeof(names) / sizeof(names[0])); ++i) {
+      if (!strcmp(env, names[i]) && i < level) {
+        level = i;
+      }
+    }
+  }
+  return level;
+}
+
+static void ebur128_init_tables(void) {
+  int i;
+
+  simd_level = ebur128_select_simd_level();
+  interp_gain_x2 = interp_init_coeffs(interp_coeffs_x2, 2);
+  interp_gain_x4 = interp_init_coeffs(interp_coeffs_x4, 4);
+
+  relative_gate_factor = pow(10.0, relative_gate / 10.0);
+  minus_twenty_decibels = pow(10.0, -20.0 / 10.0);
+  histogram_energy_boundaries[0] = pow(10.0, (-70.0 + 0.691) / 10.0);
+  for (i = 0; i < 1000; ++i) {
+    histogram_energies[i] =
+        pow(10.0, ((double) i / 10.0 - 69.95 + 0.691) / 10.0);
+  }
+  for (i = 1; i < 1001; ++i) {
+    histogram_energy_boundaries[i] =
+        pow(10.0, ((double) i / 10.0 - 70.0 + 0.691) / 10.0);
+  }
+}
+
+/* States may be created concurrently, so the tables are initialized through
+ * the platform's once primitive. */
+#ifdef _WIN32
+static INIT_ONCE tables_once = INIT_ONCE_STATIC_INIT;
+static BOOL CALLBACK ebur128_init_tables_once(PINIT_ONCE once,
+                                              PVOID parameter,
+                                              PVOID* context) {
+  (void) once;
+  (void) parameter;
+  (void) context;
+  ebur128_init_tables();
+  return TRUE;
+}
+#define EBUR128_INIT_TABLES()                                                  \
+  InitOnceExecuteOnce(&tables_once, ebur128_init_tables_once, NULL, NULL)
+#else
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+#define EBUR128_INIT_TABLES() pthread_once(&tables_once, ebur128_init_tables)
+#endif
 
-static interpolator*
-interp_create(unsigned int taps, unsigned int factor, unsigned int channels) {
-  int errcode; /* unused */
+static interpolator* interp_create(unsigned int factor, unsigned int channels) {
   interpolator* interp;
   unsigned int j;
 
   interp = (interpolator*) calloc(1, sizeof(interpolator));
-  CHECK_ERROR(!interp, 0, exit);
+  if (!interp) {
+    return NULL;
+  }
 
-  interp->taps = taps;
   interp->factor = factor;
   interp->channels = channels;
-  interp->delay = (interp->taps + interp->factor - 1) / interp->factor;
-
-  /* Initialize the filter memory
-   * One subfilter per interpolation factor. */
-  interp->filter =
-      (interp_filter*) calloc(interp->factor, sizeof(*interp->filter));
-  CHECK_ERROR(!interp->filter, 0, free_interp);
-
-  for (j = 0; j < interp->factor; j++) {
-    interp->filter[j].index =
-        (unsigned int*) calloc(interp->delay, sizeof(unsigned int));
-    interp->filter[j].coeff = (double*) calloc(interp->delay, sizeof(double));
-    CHECK_ERROR(!interp->filter[j].index || !interp->filter[j].coeff, 0,
-                free_filter_index_coeff);
-  }
+  interp->delay = (INTERP_TAPS + interp->factor - 1) / interp->factor;
+  interp->coeff = factor == 4 ? interp_coeffs_x4 : interp_coeffs_x2;
+  interp->gain = factor == 4 ? interp_gain_x4 : interp_gain_x2;
 
   /* One delay buffer per channel. */
   interp->z = (float**) calloc(interp->channels, sizeof(float*));
-  CHECK_ERROR(!interp->z, 0, free_filter_index_coeff);
-  for (j = 0; j < interp->channels; j++) {
-    interp->z[j] = (float*) calloc(interp->delay, sizeof(float));
-    CHECK_ERROR(!interp->z[j], 0, free_filter_z);
+  if (!interp->z) {
+    goto free_interp;
   }
-
-  /* Calculate the filter coefficients */
-  for (j = 0; j < interp->taps; j++) {
-    /* Calculate sinc */
-    double m = (double) j - (double) (interp->taps - 1) / 2.0;
-    double c = 1.0;
-    if (fabs(m) > ALMOST_ZERO) {
-      c = sin(m * M_PI / interp->factor) / (m * M_PI / interp->factor);
-    }
-    /* Apply Hanning window */
-    c *= 0.5 * (1 - cos(2 * M_PI * j / (interp->taps - 1)));
-
-    if (fabs(c) > ALMOST_ZERO) { /* Ignore any zero coeffs. */
-      /* Put the coefficient into the correct subfilter */
-      unsigned int f = j % interp->factor;
-      unsigned int t = interp->filter[f].count++;
-      interp->filter[f].coeff[t] = c;
-      interp->filter[f].index[t] = j / interp->factor;
+  for (j = 0; j < interp->channels; j++) {
+    interp->z[j] = (float*) calloc(interp->delay * 2, sizeof(float));
+    if (!interp->z[j]) {
+      goto free_filter_z;
     }
   }
   return interp;
@@ -178,15 +421,8 @@ free_filter_z:
     free(interp->z[j]);
   }
   free(interp->z);
-free_filter_index_coeff:
-  for (j = 0; j < interp->factor; j++) {
-    free(interp->filter[j].index);
-    free(interp->filter[j].coeff);
-  }
-  free(interp->filter);
 free_interp:
   free(interp);
-exit:
   return NULL;
 }
 
@@ -195,11 +431,6 @@ static void interp_destroy(interpolator* interp) {
   if (!interp) {
     return;
   }
-  for (j = 0; j < interp->factor; j++) {
-    free(interp->filter[j].index);
-    free(interp->filter[j].coeff);
-  }
-  free(interp->filter);
   for (j = 0; j < interp->channels; j++) {
     free(interp->z[j]);
   }
@@ -207,45 +438,612 @@ static void interp_destroy(interpolator* interp) {
   free(interp);
 }
 
-static size_t
-interp_process(interpolator* interp, size_t frames, float* in, float* out) {
-  size_t frame = 0;
-  unsigned int chan = 0;
-  unsigned int f = 0;
-  unsigned int t = 0;
-  unsigned int out_stride = interp->channels * interp->factor;
-  float* outp = 0;
-  double acc = 0;
-  double c = 0;
-
-  for (frame = 0; frame < frames; frame++) {
-    for (chan = 0; chan < interp->channels; chan++) {
-      /* Add sample to delay buffer */
-      interp->z[chan][interp->zi] = *in++;
-      /* Apply coefficients */
-      outp = out + chan;
-      for (f = 0; f < interp->factor; f++) {
-        acc = 0.0;
-        for (t = 0; t < interp->filter[f].count; t++) {
-          int i = (int) interp->zi - (int) interp->filter[f].index[t];
-          if (i < 0) {
-            i += (int) interp->delay;
-          }
-          c = interp->filter[f].coeff[t];
-          acc += (double) interp->z[chan][i] * c;
-        }
-        *outp = (float) acc;
-        outp += interp->channels;
+/* Interpolates one channel and returns the maximum of "peak" and the
+ * absolute values of all interpolated samples. Each sample is written to
+ * both halves of the delay buffer, so the last "delay" samples are always
+ * contiguous. All phases are accumulated in ascending delay order and
+ * rounded to float, like the output of a plain polyphase filter. */
+static double interp_peak_scalar(const interpolator* interp,
+                                 float* z,
+                                 const float* in,
+                                 size_t stride,
+                                 size_t frames,
+                                 double peak) {
+  unsigned int factor = interp->factor;
+  unsigned int delay = interp->delay;
+  unsigned int zi = interp->zi;
+  unsigned int d, f;
+  size_t i;
+
+  for (i = 0; i < frames; ++i) {
+    const float* x;
+    z[zi] = z[zi + delay] = in[i * stride];
+    x = z + zi + delay;
+    for (f = 0; f < factor; ++f) {
+      double acc = 0.0;
+      double val;
+      for (d = 0; d < delay; ++d) {
+        acc += (double) *(x - d) * interp->coeff[d * factor + f];
+      }
+      val = fabs((double) (float) acc);
+      if (val > peak) {
+        peak = val;
+      }
+    }
+    if (++zi == delay) {
+      zi = 0;
+    }
+  }
+  return peak;
+}
+
+/* Same as interp_peak_scalar, but with the phases in SIMD lanes. */
+#define INTERP_PEAK_LANES(name, target, factor, lanes, vec, set1, loadu, add,  \
+                          mul, max, round_abs, hmax)                           \
+  static target double name(const interpolator* interp, float* z,              \
+                            const float* in, size_t stride, size_t frames,     \
+                            double peak) {                                     \
+    unsigned int delay = interp->delay;                                        \
+    unsigned int zi = interp->zi;                                              \
+    unsigned int d, k;                                                         \
+    vec peaks = set1(peak);                                                    \
+    size_t i;                                                                  \
+                                                                               \
+    for (i = 0; i < frames; ++i) {                                             \
+      const float* x;                                                          \
+      vec acc[(factor) / (lanes)];                                             \
+      z[zi] = z[zi + delay] = in[i * stride];                                  \
+      x = z + zi + delay;                                                      \
+      for (k = 0; k < (factor) / (lanes); ++k) {                               \
+        acc[k] = set1(0.0);                                                    \
+      }                                                                        \
+      for (d = 0; d < delay; ++d) {                                            \
+        vec sample = set1((double) *(x - d));                                  \
+        const double* c = interp->coeff + d * (factor);                        \
+        for (k = 0; k < (factor) / (lanes); ++k) {                             \
+          acc[k] = add(acc[k], mul(sample, loadu(c + k * (lanes))));           \
+        }                                                                      \
+      }                                                                        \
+      for (k = 0; k < (factor) / (lanes); ++k) {                               \
+        peaks = max(peaks, round_abs(acc[k]));                                 \
+      }                                                                        \
+      if (++zi == delay) {                                                     \
+        zi = 0;                                                                \
+      }                                                                        \
+    }                                                                          \
+    return hmax(peaks);                                                        \
+  }
+
+/* Frames that the factor 2 kernels copy into their linear buffer at once. */
+#define INTERP_X2_CHUNK 64
+
+/* Same as interp_peak_scalar for factor 2, with the two phases of "group"
+ * consecutive frames in the lanes, and two such vectors at once to hide the
+ * latency of the additions. The input follows the last samples of the delay
+ * buffer in a linear buffer, which has each sample twice, so the samples of
+ * tap d of all frames of a vector are one load. Lanes of frames past the end
+ * are cleared with "keep". */
+#define INTERP_PEAK_X2_FRAMES(name, target, group, vec, set1, loadu,           \
+                              load_coeffs, add, mul, max, round_abs, keep,     \
+                              hmax)                                            \
+  static target double name(const interpolator* interp, float* z,              \
+                            const float* in, size_t stride, size_t frames,     \
+                            double peak) {                                     \
+    double lin[2 * (INTERP_MAX_DELAY + INTERP_X2_CHUNK + 2 * (group))];        \
+    unsigned int delay = interp->delay;                                        \
+    unsigned int zi = interp->zi;                                              \
+    unsigned int d;                                                            \
+    vec peaks = set1(peak);                                                    \
+    size_t i, j, n;                                                            \
+                                                                               \
+    for (j = 0; j + 1 < delay; ++j) {                                          \
+      lin[2 * j] = lin[2 * j + 1] = (double) z[zi + 1 + j];                    \
+    }                                                                          \
+    for (i = 0; i < frames; i += n) {                                          \
+      double* x = lin + 2 * (delay - 1);                                       \
+      n = EBUR128_MIN(frames - i, (size_t) INTERP_X2_CHUNK);                   \
+      for (j = 0; j < n + 2 * (group); ++j) {                                  \
+        x[2 * j] = x[2 * j + 1] = j < n ? (double) in[(i + j) * stride] : 0.0; \
+      }                                                                        \
+      for (j = 0; j < n; j += 2 * (group)) {                                   \
+        vec acc0 = set1(0.0);                                                  \
+        vec acc1 = set1(0.0);                                                  \
+        for (d = 0; d < delay; ++d) {                                          \
+          vec c = load_coeffs(interp->coeff + 2 * d);                          \
+          acc0 = add(acc0, mul(loadu(x + 2 * j - 2 * d), c));                  \
+          acc1 = add(acc1, mul(loadu(x + 2 * (j + (group)) - 2 * d), c));      \
+        }                                                                      \
+        peaks = max(peaks, keep(round_abs(acc0), n - j));                      \
+        peaks = max(peaks, keep(round_abs(acc1), n - j > (group)               \
+                                                     ? n - j - (group)         \
+                                                     : 0));                    \
+      }                                                                        \
+      memmove(lin, lin + 2 * n, 2 * (delay - 1) * sizeof(double));             \
+    }                                                                          \
+    /* the delay buffer only needs the last samples */                         \
+    i = frames > delay ? frames - delay : 0;                                   \
+    zi = (unsigned int) ((zi + i) % delay);                                    \
+    for (; i < frames; ++i) {                                                  \
+      z[zi] = z[zi + delay] = in[i * stride];                                  \
+      if (++zi == delay) {                                                     \
+        zi = 0;                                                                \
+      }                                                                        \
+    }                                                                          \
+    return hmax(peaks);                                                        \
+  }
+
+#ifdef EBUR128_HAVE_SSE2
+static __m128d interp_round_abs_sse2(__m128d v) {
+  return _mm_andnot_pd(_mm_set1_pd(-0.0), _mm_cvtps_pd(_mm_cvtpd_ps(v)));
+}
+static double interp_hmax_sse2(__m128d v) {
+  double t[2];
+  _mm_storeu_pd(t, v);
+  return EBUR128_MAX(t[0], t[1]);
+}
+INTERP_PEAK_LANES(interp_peak_x2_sse2, EBUR128_TARGET("sse2"), 2, 2, __m128d,
+                  _mm_set1_pd, _mm_loadu_pd, _mm_add_pd, _mm_mul_pd,
+                  _mm_max_pd, interp_round_abs_sse2, interp_hmax_sse2)
+INTERP_PEAK_LANES(interp_peak_x4_sse2, EBUR128_TARGET("sse2"), 4, 2, __m128d,
+                  _mm_set1_pd, _mm_loadu_pd, _mm_add_pd, _mm_mul_pd,
+                  _mm_max_pd, interp_round_abs_sse2, interp_hmax_sse2)
+#endif
+#ifdef EBUR128_HAVE_AVX2
+static EBUR128_TARGET("avx2") __m256d interp_round_abs_avx2(__m256d v) {
+  return _mm256_andnot_pd(_mm256_set1_pd(-0.0),
+                          _mm256_cvtps_pd(_mm256_cvtpd_ps(v)));
+}
+static EBUR128_TARGET("avx2") double interp_hmax_avx2(__m256d v) {
+  return interp_hmax_sse2(_mm_max_pd(_mm256_castpd256_pd128(v),
+                                     _mm256_extractf128_pd(v, 1)));
+}
+INTERP_PEAK_LANES(interp_peak_x4_avx2, EBUR128_TARGET("avx2"), 4, 4, __m256d,
+                  _mm256_set1_pd, _mm256_loadu_pd, _mm256_add_pd,
+                  _mm256_mul_pd, _mm256_max_pd, interp_round_abs_avx2,
+                  interp_hmax_avx2)
+static EBUR128_TARGET("avx2") __m256d interp_coeffs_x2_avx2(const double* c) {
+  return _mm256_broadcast_pd((const __m128d*) c);
+}
+static EBUR128_TARGET("avx2") __m256d interp_keep_x2_avx2(__m256d v,
+                                                         size_t frames) {
+  if (frames >= 2) {
+    return v;
+  }
+  return _mm256_and_pd(v, _mm256_castsi256_pd(_mm256_setr_epi64x(
+                              frames ? -1 : 0, frames ? -1 : 0, 0, 0)));
+}
+INTERP_PEAK_X2_FRAMES(interp_peak_x2_avx2, EBUR128_TARGET("avx2"), 2, __m256d,
+                      _mm256_set1_pd, _mm256_loadu_pd, interp_coeffs_x2_avx2,
+                      _mm256_add_pd, _mm256_mul_pd, _mm256_max_pd,
+                      interp_round_abs_avx2, interp_keep_x2_avx2,
+                      interp_hmax_avx2)
+#endif
+#ifdef EBUR128_HAVE_AVX512
+/* Like interp_peak_x4_avx2, but with the phases of two frames in the eight
+ * lanes. Tap d of the second frame is tap d - 1 of the first, apart from its
+ * new sample. An odd last frame is paired with silence. */
+static EBUR128_TARGET("avx512f") double interp_peak_x4_avx512(
+    const interpolator* interp, float* z, const float* in, size_t stride,
+    size_t frames, double peak) {
+  unsigned int delay = interp->delay;
+  unsigned int zi = interp->zi;
+  unsigned int d;
+  __m512d peaks = _mm512_set1_pd(peak);
+  size_t i;
+
+  for (i = 0; i < frames; i += 2) {
+    const float* x;
+    int pair = i + 1 < frames;
+    double next = pair ? (double) in[(i + 1) * stride] : 0.0;
+    __m512d acc = _mm512_setzero_pd();
+    z[zi] = z[zi + delay] = in[i * stride];
+    x = z + zi + delay;
+    for (d = 0; d < delay; ++d) {
+      double second = d == 0 ? next : pair ? (double) *(x - d + 1) : 0.0;
+      __m512d sample = _mm512_insertf64x4(_mm512_set1_pd((double) *(x - d)),
+                                          _mm256_set1_pd(second), 1);
+      __m512d c =
+          _mm512_broadcast_f64x4(_mm256_loadu_pd(interp->coeff + d * 4));
+      acc = _mm512_add_pd(acc, _mm512_mul_pd(sample, c));
+    }
+    peaks = _mm512_max_pd(
+        peaks, _mm512_abs_pd(_mm512_cvtps_pd(_mm512_cvtpd_ps(acc))));
+    if (++zi == delay) {
+      zi = 0;
+    }
+    if (pair) {
+      z[zi] = z[zi + delay] = (float) next;
+      if (++zi == delay) {
+        zi = 0;
       }
     }
-    out += out_stride;
-    interp->zi++;
-    if (interp->zi == interp->delay) {
-      interp->zi = 0;
+  }
+  return interp_hmax_avx2(_mm256_max_pd(_mm512_castpd512_pd256(peaks),
+                                        _mm512_extractf64x4_pd(peaks, 1)));
+}
+
+static EBUR128_TARGET("avx512f") __m512d
+interp_round_abs_avx512(__m512d v) {
+  return _mm512_abs_pd(_mm512_cvtps_pd(_mm512_cvtpd_ps(v)));
+}
+static EBUR128_TARGET("avx512f") double interp_hmax_avx512(__m512d v) {
+  return interp_hmax_avx2(_mm256_max_pd(_mm512_castpd512_pd256(v),
+                                        _mm512_extractf64x4_pd(v, 1)));
+}
+static EBUR128_TARGET("avx512f") __m512d
+interp_coeffs_x2_avx512(const double* c) {
+  return _mm512_broadcast_f64x4(_mm256_broadcast_pd((const __m128d*) c));
+}
+static EBUR128_TARGET("avx512f") __m512d interp_keep_x2_avx512(__m512d v,
+                                                              size_t frames) {
+  return frames >= 4 ? v
+                     : _mm512_maskz_mov_pd(
+                           (__mmask8) ((1u << (2 * frames)) - 1), v);
+}
+INTERP_PEAK_X2_FRAMES(interp_peak_x2_avx512, EBUR128_TARGET("avx512f"), 4,
+                      __m512d, _mm512_set1_pd, _mm512_loadu_pd,
+                      interp_coeffs_x2_avx512, _mm512_add_pd, _mm512_mul_pd,
+                      _mm512_max_pd, interp_round_abs_avx512,
+                      interp_keep_x2_avx512, interp_hmax_avx512)
+#endif
+
+/* Interpolates "frames" samples of channel "chan" and raises *peak to the
+ * largest absolute interpolated value. interp_advance has to be called once
+ * all channels are done. */
+static void interp_process(interpolator* interp,
+                           unsigned int chan,
+                           const float* in,
+                           size_t stride,
+                           size_t frames,
+                           double* peak) {
+  float* z = interp->z[chan];
+#ifdef EBUR128_HAVE_AVX512
+  if (interp->factor == 4 && simd_level >= EBUR128_SIMD_AVX512) {
+    *peak = interp_peak_x4_avx512(interp, z, in, stride, frames, *peak);
+    return;
+  }
+  if (interp->factor == 2 && simd_level >= EBUR128_SIMD_AVX512) {
+    *peak = interp_peak_x2_avx512(interp, z, in, stride, frames, *peak);
+    return;
+  }
+#endif
+#ifdef EBUR128_HAVE_AVX2
+  if (interp->factor == 4 && simd_level >= EBUR128_SIMD_AVX2) {
+    *peak = interp_peak_x4_avx2(interp, z, in, stride, frames, *peak);
+    return;
+  }
+  if (interp->factor == 2 && simd_level >= EBUR128_SIMD_AVX2) {
+    *peak = interp_peak_x2_avx2(interp, z, in, stride, frames, *peak);
+    return;
+  }
+#endif
+#ifdef EBUR128_HAVE_SSE2
+  if (interp->factor == 4 && simd_level >= EBUR128_SIMD_SSE2) {
+    *peak = interp_peak_x4_sse2(interp, z, in, stride, frames, *peak);
+    return;
+  }
+  if (interp->factor == 2 && simd_level >= EBUR128_SIMD_SSE2) {
+    *peak = interp_peak_x2_sse2(interp, z, in, stride, frames, *peak);
+    return;
+  }
+#endif
+  *peak = interp_peak_scalar(interp, z, in, stride, frames, *peak);
+}
+
+/* Returns an upper bound for the absolute value of the next interpolated
+ * samples of channel "chan" if no input sample is larger than "max". */
+static double interp_bound(const interpolator* interp,
+                           unsigned int chan,
+                           double max) {
+  const float* z = interp->z[chan];
+  unsigned int d;
+  for (d = 0; d < interp->delay; ++d) {
+    if (fabs((double) z[d]) > max) {
+      max = fabs((double) z[d]);
+    }
+  }
+  return max * interp->gain;
+}
+
+/* Updates the delay buffer of channel "chan" as if the "frames" samples in
+ * "in" had been interpolated. Only the last "delay" of them are read. */
+static void interp_skip(interpolator* interp,
+                        unsigned int chan,
+                        const float* in,
+                        size_t stride,
+                        size_t frames) {
+  float* z = interp->z[chan];
+  size_t count = EBUR128_MIN(frames, (size_t) interp->delay);
+  unsigned int zi =
+      (unsigned int) ((interp->zi + frames - count) % interp->delay);
+  size_t i;
+  in += (frames - count) * stride;
+  for (i = 0; i < count; ++i) {
+    z[zi] = z[zi + interp->delay] = in[i * stride];
+    if (++zi == interp->delay) {
+      zi = 0;
+    }
+  }
+}
+
+static void interp_advance(interpolator* interp, size_t frames) {
+  interp->zi = (unsigned int) ((interp->zi + frames) % interp->delay);
+}
+
+static void ebur128_tree_update(struct ebur128_tree* tree, size_t t) {
+  struct ebur128_tree_node* n = tree->nodes;
+  n[t].count = n[n[t].left].count + 1 + n[n[t].right].count;
+  n[t].sum = n[n[t].left].sum + n[t].z + n[n[t].right].sum;
+}
+
+/* Splits the subtree t into the nodes with z < value (z <= value if
+ * "inclusive" is set) and the rest. */
+static void ebur128_tree_split(struct ebur128_tree* tree,
+                               size_t t,
+                               double value,
+                               int inclusive,
+                               size_t* l,
+                               size_t* r) {
+  struct ebur128_tree_node* n = tree->nodes;
+  if (!t) {
+    *l = *r = 0;
+    return;
+  }
+  if (n[t].z < value || (inclusive && n[t].z == value)) {
+    ebur128_tree_split(tree, n[t].right, value, inclusive, &n[t].right, r);
+    *l = t;
+  } else {
+    ebur128_tree_split(tree, n[t].left, value, inclusive, l, &n[t].left);
+    *r = t;
+  }
+  ebur128_tree_update(tree, t);
+}
+
+/* Joins two subtrees, all values in l must be <= all values in r. */
+static size_t
+ebur128_tree_merge(struct ebur128_tree* tree, size_t l, size_t r) {
+  struct ebur128_tree_node* n = tree->nodes;
+  if (!l || !r) {
+    return l ? l : r;
+  }
+  if (n[l].priority > n[r].priority) {
+    n[l].right = ebur128_tree_merge(tree, n[l].right, r);
+    ebur128_tree_update(tree, l);
+    return l;
+  }
+  n[r].left = ebur128_tree_merge(tree, l, n[r].left);
+  ebur128_tree_update(tree, r);
+  return r;
+}
+
+/* Makes sure that the next ebur128_tree_insert does not need to allocate. */
+static int ebur128_tree_reserve(struct ebur128_tree* tree) {
+  struct ebur128_tree_node* nodes;
+  size_t new_capacity, new_size;
+
+  if (tree->free_list || tree->used < tree->capacity) {
+    return EBUR128_SUCCESS;
+  }
+  new_capacity = tree->capacity ? tree->capacity * 2 : 64;
+  if (new_capacity < tree->capacity ||
+      safe_size_mul(new_capacity, sizeof(*nodes), &new_size) != 0) {
+    return EBUR128_ERROR_NOMEM;
+  }
+  nodes = (struct ebur128_tree_node*) realloc(tree->nodes, new_size);
+  if (!nodes) {
+    return EBUR128_ERROR_NOMEM;
+  }
+  if (!tree->nodes) {
+    /* node 0 is the empty tree */
+    nodes[0].z = nodes[0].sum = 0.0;
+    nodes[0].count = nodes[0].left = nodes[0].right = 0;
+    nodes[0].priority = 0;
+    tree->used = 1;
+  }
+  tree->nodes = nodes;
+  tree->capacity = new_capacity;
+  return EBUR128_SUCCESS;
+}
+
+static void ebur128_tree_insert(struct ebur128_tree* tree, double z) {
+  size_t t, l, r;
+
+  if (tree->free_list) {
+    t = tree->free_list;
+    tree->free_list = tree->nodes[t].left;
+  } else {
+    t = tree->used++;
+  }
+  /* xorshift, so that the tree shape is the same for every run */
+  tree->seed ^= (tree->seed << 13) & 0xFFFFFFFFUL;
+  tree->seed ^= tree->seed >> 17;
+  tree->seed ^= (tree->seed << 5) & 0xFFFFFFFFUL;
+  tree->nodes[t].z = z;
+  tree->nodes[t].priority = tree->seed;
+  tree->nodes[t].left = tree->nodes[t].right = 0;
+  ebur128_tree_update(tree, t);
+
+  ebur128_tree_split(tree, tree->root, z, 0, &l, &r);
+  tree->root = ebur128_tree_merge(tree, ebur128_tree_merge(tree, l, t), r);
+}
+
+/* Removes one node with value z, which must be in the tree. */
+static void ebur128_tree_remove(struct ebur128_tree* tree, double z) {
+  size_t l, m, r;
+
+  ebur128_tree_split(tree, tree->root, z, 0, &l, &r);
+  ebur128_tree_split(tree, r, z, 1, &m, &r);
+  if (m) {
+    size_t t = m;
+    m = ebur128_tree_merge(tree, tree->nodes[t].left, tree->nodes[t].right);
+    tree->nodes[t].left = tree->free_list;
+    tree->free_list = t;
+  }
+  tree->root = ebur128_tree_merge(tree, ebur128_tree_merge(tree, l, m), r);
+}
+
+/* Adds the sum and number of all values >= value to *sum and *count. */
+static void ebur128_tree_sum_above(struct ebur128_tree* tree,
+                                   double value,
+                                   double* sum,
+                                   size_t* count) {
+  struct ebur128_tree_node* n = tree->nodes;
+  size_t t = tree->root;
+  while (t) {
+    if (n[t].z >= value) {
+      *sum += n[t].z + n[n[t].right].sum;
+      *count += 1 + n[n[t].right].count;
+      t = n[t].left;
+    } else {
+      t = n[t].right;
+    }
+  }
+}
+
+/* Returns the k-th smallest value in the tree, starting at 0. */
+static double ebur128_tree_select(struct ebur128_tree* tree, size_t k) {
+  struct ebur128_tree_node* n = tree->nodes;
+  size_t t = tree->root;
+  for (;;) {
+    size_t left_count = n[n[t].left].count;
+    if (k < left_count) {
+      t = n[t].left;
+    } else if (k == left_count) {
+      return n[t].z;
+    } else {
+      k -= left_count + 1;
+      t = n[t].right;
+    }
+  }
+}
+
+static void ebur128_list_init(struct ebur128_double_list* list,
+                              size_t max,
+                              int sorted) {
+  list->z = NULL;
+  list->capacity = 0;
+  list->start = 0;
+  list->size = 0;
+  list->max = max;
+  list->sorted = sorted;
+  list->tree.nodes = NULL;
+  list->tree.capacity = 0;
+  list->tree.used = 0;
+  list->tree.free_list = 0;
+  list->tree.root = 0;
+  list->tree.seed = 2463534242UL;
+}
+
+static void ebur128_list_destroy(struct ebur128_double_list* list) {
+  free(list->z);
+  free(list->tree.nodes);
+}
+
+/* Drops the oldest entry of the list. */
+static void ebur128_list_pop(struct ebur128_double_list* list) {
+  if (list->sorted) {
+    ebur128_tree_remove(&list->tree, list->z[list->start]);
+  }
+  if (++list->start == list->capacity) {
+    list->start = 0;
+  }
+  --list->size;
+}
+
+/* Appends an energy to the list, dropping the oldest one if the list is
+ * full. The buffer grows by doubling, so appending is amortized O(1). */
+static int ebur128_list_append(struct ebur128_double_list* list, double z) {
+  size_t i;
+
+  /* The tree of a sorted list finds the entries to remove by value, which
+   * never works for NaN. Both kinds of lists skip it, like the histogram. */
+  if (list->max == 0 || z != z) {
+    return EBUR128_SUCCESS;
+  }
+  if (list->size == list->capacity && list->size < list->max) {
+    size_t new_capacity = list->capacity ? list->capacity * 2 : 64;
+    size_t new_size;
+    double* new_z;
+
+    if (new_capacity > list->max || new_capacity < list->capacity) {
+      new_capacity = list->max;
+    }
+    if (safe_size_mul(new_capacity, sizeof(double), &new_size) != 0) {
+      return EBUR128_ERROR_NOMEM;
     }
+    new_z = (double*) malloc(new_size);
+    if (!new_z) {
+      return EBUR128_ERROR_NOMEM;
+    }
+    /* unwrap the ring while copying */
+    i = list->capacity - list->start;
+    if (i > list->size) {
+      i = list->size;
+    }
+    if (list->size) {
+      memcpy(new_z, list->z + list->start, i * sizeof(double));
+      memcpy(new_z + i, list->z, (list->size - i) * sizeof(double));
+    }
+    free(list->z);
+    list->z = new_z;
+    list->capacity = new_capacity;
+    list->start = 0;
+  }
+  if (list->sorted && ebur128_tree_reserve(&list->tree)) {
+    return EBUR128_ERROR_NOMEM;
+  }
+  if (list->size == list->max) {
+    ebur128_list_pop(list);
+  }
+  i = list->start + list->size;
+  if (i >= list->capacity) {
+    i -= list->capacity;
+  }
+  list->z[i] = z;
+  ++list->size;
+  if (list->sorted) {
+    ebur128_tree_insert(&list->tree, z);
   }
+  return EBUR128_SUCCESS;
+}
+
+/* Changes the maximum size of the list, dropping the oldest entries if
+ * needed. */
+static void ebur128_list_set_max(struct ebur128_double_list* list,
+                                 size_t max) {
+  list->max = max;
+  while (list->size > max) {
+    ebur128_list_pop(list);
+  }
+}
 
-  return frames * interp->factor;
+/* Starts or stops keeping the entries of the list in its tree. */
+static int ebur128_list_set_sorted(struct ebur128_double_list* list,
+                                   int sorted) {
+  size_t k, l;
+
+  if (!sorted) {
+    free(list->tree.nodes);
+    list->tree.nodes = NULL;
+    list->tree.capacity = 0;
+    list->tree.used = 0;
+    list->tree.free_list = 0;
+    list->tree.root = 0;
+    list->sorted = 0;
+    return EBUR128_SUCCESS;
+  }
+  for (k = 0, l = list->start; k < list->size; ++k) {
+    if (ebur128_tree_reserve(&list->tree)) {
+      ebur128_list_set_sorted(list, 0);
+      return EBUR128_ERROR_NOMEM;
+    }
+    ebur128_tree_insert(&list->tree, list->z[l]);
+    if (++l == list->capacity) {
+      l = 0;
+    }
+  }
+  list->sorted = 1;
+  return EBUR128_SUCCESS;
 }
 
 static int ebur128_init_filter(ebur128_state* st) {
@@ -341,60 +1139,642 @@ static int ebur128_init_channel_map(ebur128_state* st) {
   return EBUR128_SUCCESS;
 }
 
-static int ebur128_init_resampler(ebur128_state* st) {
+/* Allocates the energy buffers for a maximum window of "window" ms and resets
+ * them. On failure, the previous buffers are kept. */
+static int ebur128_init_energy(ebur128_state* st, unsigned long window) {
   int errcode = EBUR128_SUCCESS;
+  size_t window_frames, subblocks, size;
+  double* frame_energy;
+  double* subblock_energy;
+  double* channel_energy;
+  size_t j;
 
-  if (st->samplerate < 96000) {
-    st->d->interp = interp_create(49, 4, st->channels);
-    CHECK_ERROR(!st->d->interp, EBUR128_ERROR_NOMEM, exit)
-  } else if (st->samplerate < 192000) {
-    st->d->interp = interp_create(49, 2, st->channels);
-    CHECK_ERROR(!st->d->interp, EBUR128_ERROR_NOMEM, exit)
-  } else {
-    st->d->resampler_buffer_input = NULL;
-    st->d->resampler_buffer_output = NULL;
-    st->d->interp = NULL;
-    goto exit;
+  if (safe_size_mul(st->samplerate, window, &window_frames) != 0) {
+    return EBUR128_ERROR_NOMEM;
+  }
+  window_frames /= 1000;
+  /* round up to multiple of samples_in_100ms, but keep at least as many
+   * blocks as the window needs for very low samplerates */
+  subblocks = (window_frames + st->d->samples_in_100ms - 1) /
+              st->d->samples_in_100ms;
+  if (subblocks < (window + 99) / 100) {
+    subblocks = (window + 99) / 100;
+  }
+  if (safe_size_mul(subblocks, st->d->samples_in_100ms, &window_frames) != 0 ||
+      safe_size_mul(window_frames, sizeof(double), &size) != 0) {
+    return EBUR128_ERROR_NOMEM;
   }
 
-  st->d->resampler_buffer_input_frames = st->d->samples_in_100ms * 4;
-  st->d->resampler_buffer_input = (float*) malloc(
-      st->d->resampler_buffer_input_frames * st->channels * sizeof(float));
-  CHECK_ERROR(!st->d->resampler_buffer_input, EBUR128_ERROR_NOMEM, free_interp)
+  frame_energy = (double*) malloc(size);
+  CHECK_ERROR(!frame_energy, EBUR128_ERROR_NOMEM, exit)
+  subblock_energy = (double*) malloc(subblocks * sizeof(double));
+  CHECK_ERROR(!subblock_energy, EBUR128_ERROR_NOMEM, free_frame_energy)
+  channel_energy = (double*) malloc(st->channels * sizeof(double));
+  CHECK_ERROR(!channel_energy, EBUR128_ERROR_NOMEM, free_subblock_energy)
 
-  st->d->resampler_buffer_output_frames =
-      st->d->resampler_buffer_input_frames * st->d->interp->factor;
-  st->d->resampler_buffer_output = (float*) malloc(
-      st->d->resampler_buffer_output_frames * st->channels * sizeof(float));
-  CHECK_ERROR(!st->d->resampler_buffer_output, EBUR128_ERROR_NOMEM, free_input)
+  for (j = 0; j < window_frames; ++j) {
+    frame_energy[j] = 0.0;
+  }
+  for (j = 0; j < subblocks; ++j) {
+    subblock_energy[j] = 0.0;
+  }
+  for (j = 0; j < st->channels; ++j) {
+    channel_energy[j] = 0.0;
+  }
+
+  free(st->d->frame_energy);
+  free(st->d->subblock_energy);
+  free(st->d->channel_energy);
+  st->d->frame_energy = frame_energy;
+  st->d->subblock_energy = subblock_energy;
+  st->d->channel_energy = channel_energy;
+  st->d->subblocks = subblocks;
+  /* start at the beginning of the buffer */
+  st->d->subblock_index = 0;
+  st->d->subblocks_filled = 0;
+  st->d->needed_frames = st->d->samples_in_100ms;
+  /* reset short term frame counter */
+  st->d->short_term_frame_counter = 0;
 
   return errcode;
 
-free_interp:
-  interp_destroy(st->d->interp);
-  st->d->interp = NULL;
-free_input:
-  free(st->d->resampler_buffer_input);
-  st->d->resampler_buffer_input = NULL;
+free_subblock_energy:
+  free(subblock_energy);
+free_frame_energy:
+  free(frame_energy);
+exit:
+  return errcode;
+}
+
+/* Energies of the last 100ms blocks for long windows, in the leaves of a
+ * segment tree whose inner nodes hold the sums of their two children. A
+ * window is the sum of O(log n) nodes that only cover its own blocks, so it
+ * keeps its precision even after much louder blocks, and adding a block
+ * updates the O(log n) nodes above it. */
+struct ebur128_long_window {
+  /** Node i has the children 2i and 2i+1, node 1 is the root. */
+  double* sum;
+  /** The leaves, "leaves" entries starting at sum + leaves. */
+  double* energy;
+  size_t leaves;
+  /** Size of the ring buffer, one more than the blocks of the window. */
+  size_t size;
+  /** Entry of the next block. */
+  size_t index;
+  size_t filled;
+};
+
+static void
+ebur128_long_window_destroy(struct ebur128_long_window* long_window) {
+  if (long_window) {
+    free(long_window->sum);
+  }
+  free(long_window);
+}
+
+static void ebur128_long_window_reset(struct ebur128_long_window* long_window) {
+  memset(long_window->sum, 0, 2 * long_window->leaves * sizeof(double));
+  long_window->index = 0;
+  long_window->filled = 0;
+}
+
+static void ebur128_long_window_add(struct ebur128_long_window* long_window,
+                                    double energy) {
+  double* sum = long_window->sum;
+  size_t i = long_window->leaves + long_window->index;
+
+  sum[i] = energy;
+  for (i /= 2; i > 0; i /= 2) {
+    sum[i] = sum[2 * i] + sum[2 * i + 1];
+  }
+  if (++long_window->index == long_window->size) {
+    long_window->index = 0;
+  }
+  if (long_window->filled < long_window->size) {
+    ++long_window->filled;
+  }
+}
+
+/* Sum of the entries "first" up to "end" (exclusive) of the ring buffer. */
+static double
+ebur128_long_window_range(const struct ebur128_long_window* long_window,
+                          size_t first,
+                          size_t end) {
+  double sum = 0.0;
+
+  first += long_window->leaves;
+  end += long_window->leaves;
+  for (; first < end; first /= 2, end /= 2) {
+    if (first & 1) {
+      sum += long_window->sum[first++];
+    }
+    if (end & 1) {
+      sum += long_window->sum[--end];
+    }
+  }
+  return sum;
+}
+
+/* Sum of the energies of the last "blocks" completed blocks, which must be
+ * less than the size of the ring buffer, in O(log n). */
+static double
+ebur128_long_window_sum(const struct ebur128_long_window* long_window,
+                        size_t blocks) {
+  size_t size = long_window->size;
+  size_t index = long_window->index;
+  size_t first;
+
+  if (blocks == 0) {
+    return 0.0;
+  }
+  if (blocks >= long_window->filled) {
+    /* the other leaves are still zero */
+    return long_window->sum[1];
+  }
+  first = (index + size - blocks) % size;
+  if (first < index) {
+    return ebur128_long_window_range(long_window, first, index);
+  }
+  return ebur128_long_window_range(long_window, first, size) +
+         ebur128_long_window_range(long_window, 0, index);
+}
+
+static int ebur128_init_resampler(ebur128_state* st) {
+  int errcode = EBUR128_SUCCESS;
+
+  if (st->samplerate < 96000) {
+    st->d->interp = interp_create(4, st->channels);
+    CHECK_ERROR(!st->d->interp, EBUR128_ERROR_NOMEM, exit)
+  } else if (st->samplerate < 192000) {
+    st->d->interp = interp_create(2, st->channels);
+    CHECK_ERROR(!st->d->interp, EBUR128_ERROR_NOMEM, exit)
+  } else {
+    st->d->interp = NULL;
+  }
+
 exit:
   return errcode;
 }
 
 static void ebur128_destroy_resampler(ebur128_state* st) {
-  free(st->d->resampler_buffer_input);
-  st->d->resampler_buffer_input = NULL;
-  free(st->d->resampler_buffer_output);
-  st->d->resampler_buffer_output = NULL;
   interp_destroy(st->d->interp);
   st->d->interp = NULL;
 }
 
+#ifdef _WIN32
+typedef HANDLE ebur128_thread;
+typedef CRITICAL_SECTION ebur128_mutex;
+typedef CONDITION_VARIABLE ebur128_cond;
+#define EBUR128_THREAD_FUNC(name, arg) static DWORD WINAPI name(LPVOID arg)
+#define EBUR128_THREAD_RETURN return 0
+#define ebur128_thread_start(thread, func, arg)                                \
+  ((*(thread) = CreateThread(NULL, 0, func, arg, 0, NULL)) == NULL)
+#define ebur128_thread_join(thread)                                            \
+  (WaitForSingleObject(thread, INFINITE), CloseHandle(thread))
+#define ebur128_mutex_init(mutex) (InitializeCriticalSection(mutex), 0)
+#define ebur128_mutex_destroy(mutex) DeleteCriticalSection(mutex)
+#define ebur128_mutex_lock(mutex) EnterCriticalSection(mutex)
+#define ebur128_mutex_unlock(mutex) LeaveCriticalSection(mutex)
+#define ebur128_cond_init(cond) (InitializeConditionVariable(cond), 0)
+#define ebur128_cond_destroy(cond)
+#define ebur128_cond_wait(cond, mutex)                                         \
+  SleepConditionVariableCS(cond, mutex, INFINITE)
+#define ebur128_cond_broadcast(cond) WakeAllConditionVariable(cond)
+typedef HANDLE ebur128_sem;
+#define ebur128_sem_init(sem)                                                  \
+  ((*(sem) = CreateSemaphore(NULL, 0, LONG_MAX, NULL)) == NULL)
+#define ebur128_sem_destroy(sem) CloseHandle(*(sem))
+#define ebur128_sem_wait(sem) WaitForSingleObject(*(sem), INFINITE)
+#define ebur128_sem_post(sem) ReleaseSemaphore(*(sem), 1, NULL)
+#else
+typedef pthread_t ebur128_thread;
+typedef pthread_mutex_t ebur128_mutex;
+typedef pthread_cond_t ebur128_cond;
+#define EBUR128_THREAD_FUNC(name, arg) static void* name(void* arg)
+#define EBUR128_THREAD_RETURN return NULL
+#define ebur128_thread_start(thread, func, arg)                                \
+  pthread_create(thread, NULL, func, arg)
+#define ebur128_thread_join(thread) pthread_join(thread, NULL)
+#define ebur128_mutex_init(mutex) pthread_mutex_init(mutex, NULL)
+#define ebur128_mutex_destroy(mutex) pthread_mutex_destroy(mutex)
+#define ebur128_mutex_lock(mutex) pthread_mutex_lock(mutex)
+#define ebur128_mutex_unlock(mutex) pthread_mutex_unlock(mutex)
+#define ebur128_cond_init(cond) pthread_cond_init(cond, NULL)
+#define ebur128_cond_destroy(cond) pthread_cond_destroy(cond)
+#define ebur128_cond_wait(cond, mutex) pthread_cond_wait(cond, mutex)
+#define ebur128_cond_broadcast(cond) pthread_cond_broadcast(cond)
+/* Semaphores are posted from real-time threads, which must not lock. Unnamed
+ * POSIX semaphores are not implemented on macOS. */
+#ifdef __APPLE__
+typedef dispatch_semaphore_t ebur128_sem;
+#define ebur128_sem_init(sem) ((*(sem) = dispatch_semaphore_create(0)) == NULL)
+#define ebur128_sem_destroy(sem) dispatch_release(*(sem))
+#define ebur128_sem_wait(sem)                                                  \
+  dispatch_semaphore_wait(*(sem), DISPATCH_TIME_FOREVER)
+#define ebur128_sem_post(sem) dispatch_semaphore_signal(*(sem))
+#else
+typedef sem_t ebur128_sem;
+#define ebur128_sem_init(sem) sem_init(sem, 0, 0)
+#define ebur128_sem_destroy(sem) sem_destroy(sem)
+#define ebur128_sem_wait(sem) sem_wait(sem)
+#define ebur128_sem_post(sem) sem_post(sem)
+#endif
+#endif
+
+/* Indices of queues with one producer and one consumer, which are shared
+ * without locks. All accesses are sequentially consistent. */
+#ifdef _WIN32
+typedef LONG ebur128_atomic;
+typedef LONG ebur128_atomic32;
+#define ebur128_atomic_load(p) InterlockedCompareExchange((p), 0, 0)
+#define ebur128_atomic_store(p, v) InterlockedExchange((p), (v))
+#else
+typedef long ebur128_atomic;
+/* The same on all word sizes, for memory shared between processes. */
+typedef int32_t ebur128_atomic32;
+#define ebur128_atomic_load(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define ebur128_atomic_store(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#endif
+
+/* Orders the memory accesses before and after it, for seqlocks. */
+#ifdef _WIN32
+#define ebur128_atomic_fence() MemoryBarrier()
+#else
+#define ebur128_atomic_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+/* Payload of seqlocks. Readers copy it while it may be written, so each word
+ * is accessed atomically, and ordered by the fences around the copy. */
+#ifdef _WIN32
+typedef LONGLONG ebur128_word;
+#define ebur128_word_load(p) InterlockedCompareExchange64((p), 0, 0)
+#define ebur128_word_store(p, v) InterlockedExchange64((p), (v))
+#else
+typedef uint64_t ebur128_word;
+#define ebur128_word_load(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define ebur128_word_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#endif
+
+/* Longest segment that a worker filters at once, in 100ms blocks. */
+#define EBUR128_MAX_SEGMENT_BLOCKS 100
+/* Shorter segments are not worth the second filter pass. */
+#define EBUR128_MIN_SEGMENT_BLOCKS 10
+/* Blocks that the filter needs to forget its state. Its slowest poles, the
+ * double pole of the 38 Hz high pass, decay by a factor of e^-24 per 100ms,
+ * so the effect of the state after three blocks is far below rounding. */
+#define EBUR128_SETTLE_BLOCKS 3
+#define EBUR128_MAX_THREADS 64
+
+/* What a worker changes while filtering a segment. "st" and "d" are shallow
+ * copies of the real state with these buffers swapped in, so that the
+ * regular filter code can run on them. */
+struct ebur128_worker {
+  ebur128_state st;
+  struct ebur128_state_internal d;
+  filter_state* v;
+  double* channel_energy;
+  double* prev_sample_peak;
+  double* prev_true_peak;
+  interpolator* interp;
+  /** Frame energies of blocks that are not kept in the ring buffer. */
+  double* frame_energy;
+};
+
+struct ebur128_pool_thread {
+  struct ebur128_pool* pool;
+  unsigned int index;
+  ebur128_thread thread;
+};
+
+struct ebur128_pool {
+  unsigned int threads;
+  struct ebur128_pool_thread* slots;
+  ebur128_mutex lock;
+  ebur128_cond wake;
+  ebur128_cond done;
+  unsigned long generation;
+  unsigned int pending;
+  int quit;
+  /* Runs job(arg, i) for i in [0, threads), the calling thread takes i = 0 */
+  ebur128_task job;
+  void* arg;
+  /** One per thread, allocated for the channels, the samplerate and the
+   *  interpolation factor below. */
+  struct ebur128_worker* workers;
+  /** Per-channel energy of each block of a parallel call. */
+  double* block_energy;
+  unsigned int channels;
+  unsigned long samplerate;
+  unsigned int factor;
+};
+
+EBUR128_THREAD_FUNC(ebur128_pool_main, arg) {
+  struct ebur128_pool_thread* slot = (struct ebur128_pool_thread*) arg;
+  struct ebur128_pool* pool = slot->pool;
+  unsigned long generation = 0;
+
+  ebur128_mutex_lock(&pool->lock);
+  for (;;) {
+    while (pool->generation == generation && !pool->quit) {
+      ebur128_cond_wait(&pool->wake, &pool->lock);
+    }
+    if (pool->quit) {
+      break;
+    }
+    generation = pool->generation;
+    ebur128_mutex_unlock(&pool->lock);
+    pool->job(pool->arg, slot->index);
+    ebur128_mutex_lock(&pool->lock);
+    if (--pool->pending == 0) {
+      ebur128_cond_broadcast(&pool->done);
+    }
+  }
+  ebur128_mutex_unlock(&pool->lock);
+  EBUR128_THREAD_RETURN;
+}
+
+static void ebur128_pool_run(struct ebur128_pool* pool,
+                             ebur128_task job,
+                             void* arg) {
+  ebur128_mutex_lock(&pool->lock);
+  pool->job = job;
+  pool->arg = arg;
+  pool->pending = pool->threads - 1;
+  ++pool->generation;
+  ebur128_cond_broadcast(&pool->wake);
+  ebur128_mutex_unlock(&pool->lock);
+
+  job(arg, 0);
+
+  ebur128_mutex_lock(&pool->lock);
+  while (pool->pending > 0) {
+    ebur128_cond_wait(&pool->done, &pool->lock);
+  }
+  ebur128_mutex_unlock(&pool->lock);
+}
+
+static void ebur128_pool_free_workers(struct ebur128_pool* pool) {
+  unsigned int i;
+  for (i = 0; i < pool->threads; ++i) {
+    struct ebur128_worker* w = &pool->workers[i];
+    free(w->v);
+    free(w->channel_energy);
+    free(w->prev_sample_peak);
+    free(w->prev_true_peak);
+    interp_destroy(w->interp);
+    free(w->frame_energy);
+    memset(w, 0, sizeof(*w));
+  }
+  free(pool->block_energy);
+  pool->block_energy = NULL;
+  pool->channels = 0;
+}
+
+static void ebur128_pool_destroy(struct ebur128_pool* pool) {
+  unsigned int i;
+
+  if (!pool) {
+    return;
+  }
+  ebur128_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  ebur128_cond_broadcast(&pool->wake);
+  ebur128_mutex_unlock(&pool->lock);
+  for (i = 0; i + 1 < pool->threads; ++i) {
+    ebur128_thread_join(pool->slots[i].thread);
+  }
+  ebur128_cond_destroy(&pool->done);
+  ebur128_cond_destroy(&pool->wake);
+  ebur128_mutex_destroy(&pool->lock);
+  ebur128_pool_free_workers(pool);
+  free(pool->workers);
+  free(pool->slots);
+  free(pool);
+}
+
+static struct ebur128_pool* ebur128_pool_create(unsigned int threads) {
+  struct ebur128_pool* pool;
+  unsigned int i;
+
+  pool = (struct ebur128_pool*) calloc(1, sizeof(struct ebur128_pool));
+  if (!pool) {
+    goto exit;
+  }
+  pool->workers = (struct ebur128_worker*) calloc(
+      threads, sizeof(struct ebur128_worker));
+  if (!pool->workers) {
+    goto free_pool;
+  }
+  pool->slots = (struct ebur128_pool_thread*) calloc(
+      threads, sizeof(struct ebur128_pool_thread));
+  if (!pool->slots) {
+    goto free_workers;
+  }
+  if (ebur128_mutex_init(&pool->lock)) {
+    goto free_slots;
+  }
+  if (ebur128_cond_init(&pool->wake)) {
+    goto free_lock;
+  }
+  if (ebur128_cond_init(&pool->done)) {
+    goto free_wake;
+  }
+
+  /* pool->threads counts the started threads, plus the calling thread */
+  pool->threads = 1;
+  for (i = 0; i + 1 < threads; ++i) {
+    pool->slots[i].pool = pool;
+    pool->slots[i].index = i + 1;
+    if (ebur128_thread_start(&pool->slots[i].thread, ebur128_pool_main,
+                             &pool->slots[i])) {
+      ebur128_pool_destroy(pool);
+      return NULL;
+    }
+    ++pool->threads;
+  }
+  return pool;
+
+free_wake:
+  ebur128_cond_destroy(&pool->wake);
+free_lock:
+  ebur128_mutex_destroy(&pool->lock);
+free_slots:
+  free(pool->slots);
+free_workers:
+  free(pool->workers);
+free_pool:
+  free(pool);
+exit:
+  return NULL;
+}
+
+/* (Re)allocates the worker buffers if the parameters of st have changed. */
+static int ebur128_pool_prepare(ebur128_state* st) {
+  struct ebur128_pool* pool = st->d->pool;
+  unsigned int factor = st->d->interp ? st->d->interp->factor : 0;
+  unsigned int i;
+  int errcode = EBUR128_SUCCESS;
+
+  if (pool->channels == st->channels &&
+      pool->samplerate == st->samplerate && pool->factor == factor) {
+    return EBUR128_SUCCESS;
+  }
+  ebur128_pool_free_workers(pool);
+  pool->block_energy =
+      (double*) malloc(pool->threads * EBUR128_MAX_SEGMENT_BLOCKS *
+                       st->channels * sizeof(double));
+  CHECK_ERROR(!pool->block_energy, EBUR128_ERROR_NOMEM, free_workers)
+  for (i = 0; i < pool->threads; ++i) {
+    struct ebur128_worker* w = &pool->workers[i];
+    w->v = (filter_state*) calloc(st->channels, sizeof(filter_state));
+    CHECK_ERROR(!w->v, EBUR128_ERROR_NOMEM, free_workers)
+    w->channel_energy = (double*) malloc(st->channels * sizeof(double));
+    CHECK_ERROR(!w->channel_energy, EBUR128_ERROR_NOMEM, free_workers)
+    w->prev_sample_peak = (double*) malloc(st->channels * sizeof(double));
+    CHECK_ERROR(!w->prev_sample_peak, EBUR128_ERROR_NOMEM, free_workers)
+    w->prev_true_peak = (double*) malloc(st->channels * sizeof(double));
+    CHECK_ERROR(!w->prev_true_peak, EBUR128_ERROR_NOMEM, free_workers)
+    w->frame_energy =
+        (double*) malloc(st->d->samples_in_100ms * sizeof(double));
+    CHECK_ERROR(!w->frame_energy, EBUR128_ERROR_NOMEM, free_workers)
+    if (factor) {
+      w->interp = interp_create(factor, st->channels);
+      CHECK_ERROR(!w->interp, EBUR128_ERROR_NOMEM, free_workers)
+    }
+  }
+  pool->channels = st->channels;
+  pool->samplerate = st->samplerate;
+  pool->factor = factor;
+  return errcode;
+
+free_workers:
+  ebur128_pool_free_workers(pool);
+  return errcode;
+}
+
+/* A group of adjacent channels, filtered by one task. "st" and "d" are
+ * shallow copies of the real state that only see these channels. */
+struct ebur128_channel_part {
+  ebur128_state st;
+  struct ebur128_state_internal d;
+  interpolator interp;
+  size_t first; /* first channel */
+  /* Energy of each frame and channel, interleaved. */
+  double* frame_energy;
+};
+
+struct ebur128_channel_parts {
+  unsigned int count; /* requested */
+  unsigned int used;  /* parts needed for the current channels */
+  ebur128_task_runner run;
+  void* user;
+  struct ebur128_pool* pool; /* used if run is NULL */
+  struct ebur128_channel_part* part;
+  /* The frame energy buffers are allocated for these. */
+  unsigned int channels;
+  unsigned long samples_in_100ms;
+  /* Arguments of the current ebur128_filter_parts call. */
+  const struct ebur128_format* format;
+  const void* const* src;
+  size_t stride;
+  size_t frames;
+};
+
+static void ebur128_channel_parts_free(struct ebur128_channel_parts* parts) {
+  unsigned int k;
+  for (k = 0; k < parts->count; ++k) {
+    free(parts->part[k].frame_energy);
+    parts->part[k].frame_energy = NULL;
+  }
+  parts->channels = 0;
+}
+
+static void ebur128_channel_parts_destroy(struct ebur128_channel_parts* parts) {
+  if (!parts) {
+    return;
+  }
+  ebur128_channel_parts_free(parts);
+  free(parts->part);
+  free(parts);
+}
+
+/* Splits the channels of st into as many parts as requested, up to one per
+ * channel, and points the part states into st. Parts hold a multiple of 8
+ * channels if that keeps their number, so that they fill the widest SIMD
+ * kernel, and nearly equal numbers of channels otherwise. */
+static int ebur128_channel_parts_prepare(ebur128_state* st) {
+  struct ebur128_channel_parts* parts = st->d->parts;
+  size_t groups = EBUR128_MIN(parts->count, st->channels);
+  size_t width = (st->channels + groups - 1) / groups;
+  size_t aligned = (width + 7) / 8 * 8;
+  int even = width <= 8 || (st->channels + aligned - 1) / aligned != groups;
+  size_t k;
+
+  if (!even) {
+    width = aligned;
+  }
+  if (parts->channels != st->channels ||
+      parts->samples_in_100ms != st->d->samples_in_100ms) {
+    ebur128_channel_parts_free(parts);
+    for (k = 0; k < parts->count; ++k) {
+      parts->part[k].frame_energy =
+          (double*) malloc(st->d->samples_in_100ms * width * sizeof(double));
+      if (!parts->part[k].frame_energy) {
+        ebur128_channel_parts_free(parts);
+        return EBUR128_ERROR_NOMEM;
+      }
+    }
+    parts->channels = st->channels;
+    parts->samples_in_100ms = st->d->samples_in_100ms;
+  }
+
+  parts->used = (unsigned int) groups;
+  for (k = 0; k < groups; ++k) {
+    struct ebur128_channel_part* p = &parts->part[k];
+    size_t first = even ? k * st->channels / groups : k * width;
+    size_t end = even ? (k + 1) * st->channels / groups : first + width;
+    end = EBUR128_MIN(end, st->channels);
+    p->st = *st;
+    p->d = *st->d;
+    p->st.d = &p->d;
+    p->first = first;
+    p->st.channels = (unsigned int) (end - first);
+    p->d.streams = p->st.channels;
+    p->d.pool = NULL;
+    p->d.parts = NULL;
+    p->d.true_peak_worker = NULL;
+    p->d.v = st->d->v + first;
+    p->d.channel_energy = st->d->channel_energy + first;
+    p->d.channel_map = st->d->channel_map + first;
+    p->d.sample_peak = st->d->sample_peak + first;
+    p->d.prev_sample_peak = st->d->prev_sample_peak + first;
+    p->d.true_peak = st->d->true_peak + first;
+    p->d.prev_true_peak = st->d->prev_true_peak + first;
+    if (st->d->block_callback) {
+      p->d.block_sample_peak = st->d->block_sample_peak + first;
+      p->d.block_true_peak = st->d->block_true_peak + first;
+    }
+    if (st->d->interp) {
+      p->interp = *st->d->interp;
+      p->interp.channels = p->st.channels;
+      p->interp.z = st->d->interp->z + first;
+      p->d.interp = &p->interp;
+    }
+  }
+  return EBUR128_SUCCESS;
+}
+
 void ebur128_get_version(int* major, int* minor, int* patch) {
   *major = EBUR128_VERSION_MAJOR;
   *minor = EBUR128_VERSION_MINOR;
   *patch = EBUR128_VERSION_PATCH;
 }
 
+int ebur128_get_simd_level(void) {
+  EBUR128_INIT_TABLES();
+  return simd_level;
+}
+
 #define VALIDATE_MAX_CHANNELS (64)
 #define VALIDATE_MAX_SAMPLERATE (2822400)
 
@@ -415,10 +1795,11 @@ ebur128_init(unsigned int channels, unsigned long samplerate, int mode) {
   int errcode;
   ebur128_state* st;
   unsigned int i;
-  size_t j;
 
   VALIDATE_CHANNELS_AND_SAMPLERATE(NULL);
 
+  EBUR128_INIT_TABLES();
+
   st = (ebur128_state*) malloc(sizeof(ebur128_state));
   CHECK_ERROR(!st, 0, exit)
   st->d = (struct ebur128_state_internal*) malloc(
@@ -455,22 +1836,14 @@ ebur128_init(unsigned int channels, unsigned long samplerate, int mode) {
   } else {
     goto free_prev_true_peak;
   }
-  st->d->audio_data_frames = st->samplerate * st->d->window / 1000;
-  if (st->d->audio_data_frames % st->d->samples_in_100ms) {
-    /* round up to multiple of samples_in_100ms */
-    st->d->audio_data_frames =
-        (st->d->audio_data_frames + st->d->samples_in_100ms) -
-        (st->d->audio_data_frames % st->d->samples_in_100ms);
-  }
-  st->d->audio_data = (double*) malloc(st->d->audio_data_frames * st->channels *
-                                       sizeof(double));
-  CHECK_ERROR(!st->d->audio_data, 0, free_prev_true_peak)
-  for (j = 0; j < st->d->audio_data_frames * st->channels; ++j) {
-    st->d->audio_data[j] = 0.0;
-  }
+  st->d->frame_energy = NULL;
+  st->d->subblock_energy = NULL;
+  st->d->channel_energy = NULL;
+  errcode = ebur128_init_energy(st, st->d->window);
+  CHECK_ERROR(errcode, 0, free_prev_true_peak)
 
   errcode = ebur128_init_filter(st);
-  CHECK_ERROR(errcode, 0, free_audio_data)
+  CHECK_ERROR(errcode, 0, free_energy)
 
   if (st->d->use_histogram) {
     st->d->block_energy_histogram =
@@ -493,36 +1866,29 @@ ebur128_init(unsigned int channels, unsigned long samplerate, int mode) {
   } else {
     st->d->short_term_block_energy_histogram = NULL;
   }
-  STAILQ_INIT(&st->d->block_list);
-  st->d->block_list_size = 0;
-  st->d->block_list_max = st->d->history / 100;
-  STAILQ_INIT(&st->d->short_term_block_list);
-  st->d->st_block_list_size = 0;
-  st->d->st_block_list_max = st->d->history / 3000;
-  st->d->short_term_frame_counter = 0;
+  ebur128_list_init(&st->d->block_list, st->d->history / 100,
+                    mode & EBUR128_MODE_INCREMENTAL ? 1 : 0);
+  ebur128_list_init(&st->d->short_term_block_list, st->d->history / 3000,
+                    mode & EBUR128_MODE_INCREMENTAL ? 1 : 0);
 
   result = ebur128_init_resampler(st);
   CHECK_ERROR(result, 0, free_short_term_block_energy_histogram)
 
-  /* the first block needs 400ms of audio data */
-  st->d->needed_frames = st->d->samples_in_100ms * 4;
-  /* start at the beginning of the buffer */
-  st->d->audio_data_index = 0;
-
-  /* initialize static constants */
-  relative_gate_factor = pow(10.0, relative_gate / 10.0);
-  minus_twenty_decibels = pow(10.0, -20.0 / 10.0);
-  histogram_energy_boundaries[0] = pow(10.0, (-70.0 + 0.691) / 10.0);
-  if (st->d->use_histogram) {
-    for (i = 0; i < 1000; ++i) {
-      histogram_energies[i] =
-          pow(10.0, ((double) i / 10.0 - 69.95 + 0.691) / 10.0);
-    }
-    for (i = 1; i < 1001; ++i) {
-      histogram_energy_boundaries[i] =
-          pow(10.0, ((double) i / 10.0 - 70.0 + 0.691) / 10.0);
-    }
-  }
+  st->d->pool = NULL;
+  st->d->streams = 1;
+  st->d->parts = NULL;
+  st->d->true_peak_worker = NULL;
+  st->d->snapshot = NULL;
+  st->d->shared = NULL;
+  st->d->block_callback = NULL;
+  st->d->block_user = NULL;
+  st->d->block_sample_peak = NULL;
+  st->d->block_true_peak = NULL;
+  st->d->timeline = NULL;
+  st->d->long_window = NULL;
+  st->d->first_block = 0;
+  st->d->blocks = 0;
+  st->d->preroll = 0;
 
   return st;
 
@@ -532,8 +1898,10 @@ free_block_energy_histogram:
   free(st->d->block_energy_histogram);
 free_filter:
   free(st->d->v);
-free_audio_data:
-  free(st->d->audio_data);
+free_energy:
+  free(st->d->frame_energy);
+  free(st->d->subblock_energy);
+  free(st->d->channel_energy);
 free_prev_true_peak:
   free(st->d->prev_true_peak);
 free_true_peak:
@@ -552,51 +1920,37 @@ exit:
   return NULL;
 }
 
+static void ebur128_true_peak_worker_destroy(ebur128_state* st);
+static void ebur128_timeline_destroy(struct ebur128_timeline* timeline);
+
 void ebur128_destroy(ebur128_state** st) {
-  struct ebur128_dq_entry* entry;
+  /* the worker uses the interpolator and the true peaks */
+  ebur128_true_peak_worker_destroy(*st);
   free((*st)->d->short_term_block_energy_histogram);
   free((*st)->d->block_energy_histogram);
   free((*st)->d->v);
-  free((*st)->d->audio_data);
+  free((*st)->d->frame_energy);
+  free((*st)->d->subblock_energy);
+  free((*st)->d->channel_energy);
   free((*st)->d->channel_map);
   free((*st)->d->sample_peak);
   free((*st)->d->prev_sample_peak);
   free((*st)->d->true_peak);
   free((*st)->d->prev_true_peak);
-  while (!STAILQ_EMPTY(&(*st)->d->block_list)) {
-    entry = STAILQ_FIRST(&(*st)->d->block_list);
-    STAILQ_REMOVE_HEAD(&(*st)->d->block_list, entries);
-    free(entry);
-  }
-  while (!STAILQ_EMPTY(&(*st)->d->short_term_block_list)) {
-    entry = STAILQ_FIRST(&(*st)->d->short_term_block_list);
-    STAILQ_REMOVE_HEAD(&(*st)->d->short_term_block_list, entries);
-    free(entry);
-  }
+  ebur128_list_destroy(&(*st)->d->block_list);
+  ebur128_list_destroy(&(*st)->d->short_term_block_list);
   ebur128_destroy_resampler(*st);
+  ebur128_pool_destroy((*st)->d->pool);
+  ebur128_channel_parts_destroy((*st)->d->parts);
+  free((*st)->d->snapshot);
+  free((*st)->d->block_sample_peak);
+  ebur128_timeline_destroy((*st)->d->timeline);
+  ebur128_long_window_destroy((*st)->d->long_window);
   free((*st)->d);
   free(*st);
   *st = NULL;
 }
 
-static void ebur128_check_true_peak(ebur128_state* st, size_t frames) {
-  size_t c, i, frames_out;
-
-  frames_out =
-      interp_process(st->d->interp, frames, st->d->resampler_buffer_input,
-                     st->d->resampler_buffer_output);
-
-  for (i = 0; i < frames_out; ++i) {
-    for (c = 0; c < st->channels; ++c) {
-      double val =
-          (double) st->d->resampler_buffer_output[i * st->channels + c];
-
-      if (EBUR128_MAX(val, -val) > st->d->prev_true_peak[c]) {
-        st->d->prev_true_peak[c] = EBUR128_MAX(val, -val);
-      }
-    }
-  }
-}
 
 #if defined(__SSE2_MATH__) || defined(_M_X64) || _M_IX86_FP >= 2
 #include <xmmintrin.h>
@@ -616,162 +1970,763 @@ static void ebur128_check_true_peak(ebur128_state* st, size_t frames) {
   st->d->v[c][1] = fabs(st->d->v[c][1]) < DBL_MIN ? 0.0 : st->d->v[c][1];
 #endif
 
-#define EBUR128_FILTER(type, min_scale, max_scale)                             \
-  static void ebur128_filter_##type(ebur128_state* st, const type* src,        \
-                                    size_t frames) {                           \
-    static double scaling_factor =                                             \
-        EBUR128_MAX(-((double) (min_scale)), (double) (max_scale));            \
-                                                                               \
-    double* audio_data = st->d->audio_data + st->d->audio_data_index;          \
-    size_t i, c;                                                               \
-                                                                               \
-    TURN_ON_FTZ                                                                \
+/* Number of frames of the scaled input that are filtered at once. */
+#define EBUR128_TILE_SIZE 2048
+
+/* Returns the weight of a channel in the sum of the channel energies. */
+static double ebur128_channel_weight(int channel) {
+  if (channel == EBUR128_UNUSED) {
+    return 0.0;
+  } else if (channel == EBUR128_Mp110 || channel == EBUR128_Mm110 ||
+             channel == EBUR128_Mp060 || channel == EBUR128_Mm060 ||
+             channel == EBUR128_Mp090 || channel == EBUR128_Mm090) {
+    return 1.41;
+  } else if (channel == EBUR128_DUAL_MONO) {
+    return 2.0;
+  }
+  return 1.0;
+}
+
+/* Runs the BS.1770 filter in place over a tile of interleaved frames for a
+ * single channel. Each sample is replaced by its weighted energy, which is
+ * also added to the energy of the current 100ms block. */
+static void ebur128_filter_channel(ebur128_state* st,
+                                   double* tile,
+                                   size_t stride,
+                                   size_t frames,
+                                   size_t c) {
+  double weight = ebur128_channel_weight(st->d->channel_map[c]);
+  double energy = st->d->channel_energy[c];
+  size_t i;
+  for (i = 0; i < frames; ++i) {
+    double y;
+    st->d->v[c][0] = tile[i * stride + c] - /**/
+                     st->d->a[1] * st->d->v[c][1] - /**/
+                     st->d->a[2] * st->d->v[c][2] - /**/
+                     st->d->a[3] * st->d->v[c][3] - /**/
+                     st->d->a[4] * st->d->v[c][4];
+    y = st->d->b[0] * st->d->v[c][0] + /**/
+        st->d->b[1] * st->d->v[c][1] + /**/
+        st->d->b[2] * st->d->v[c][2] + /**/
+        st->d->b[3] * st->d->v[c][3] + /**/
+        st->d->b[4] * st->d->v[c][4];
+    tile[i * stride + c] = y * y * weight;
+    energy += tile[i * stride + c];
+    st->d->v[c][4] = st->d->v[c][3];
+    st->d->v[c][3] = st->d->v[c][2];
+    st->d->v[c][2] = st->d->v[c][1];
+    st->d->v[c][1] = st->d->v[c][0];
+  }
+  st->d->channel_energy[c] = energy;
+  FLUSH_MANUALLY
+}
+
+/* Same as ebur128_filter_channel, but for "lanes" adjacent channels at once,
+ * starting at channel c. The channels live in the SIMD lanes and the filter
+ * state is kept in registers for the whole tile. The operations are done in
+ * the same order as in the scalar version, so the results are identical. */
+#define EBUR128_FILTER_LANES(name, target, lanes, vec, set1, loadu, storeu,    \
+                             add, sub, mul)                                    \
+  static target void name(ebur128_state* st, double* tile, size_t stride,      \
+                          size_t frames, size_t c) {                           \
+    double state[FILTER_STATE_SIZE][lanes];                                    \
+    double weight[lanes];                                                      \
+    double energy[lanes];                                                      \
+    vec a1 = set1(st->d->a[1]), a2 = set1(st->d->a[2]);                        \
+    vec a3 = set1(st->d->a[3]), a4 = set1(st->d->a[4]);                        \
+    vec b0 = set1(st->d->b[0]), b1 = set1(st->d->b[1]);                        \
+    vec b2 = set1(st->d->b[2]), b3 = set1(st->d->b[3]);                        \
+    vec b4 = set1(st->d->b[4]);                                                \
+    vec v0, v1, v2, v3, v4, y, w, e;                                           \
+    size_t i, l;                                                               \
                                                                                \
-    if ((st->mode & EBUR128_MODE_SAMPLE_PEAK) == EBUR128_MODE_SAMPLE_PEAK) {   \
-      for (c = 0; c < st->channels; ++c) {                                     \
-        double max = 0.0;                                                      \
-        for (i = 0; i < frames; ++i) {                                         \
-          double cur = (double) src[i * st->channels + c];                     \
-          if (EBUR128_MAX(cur, -cur) > max) {                                  \
-            max = EBUR128_MAX(cur, -cur);                                      \
-          }                                                                    \
-        }                                                                      \
-        max /= scaling_factor;                                                 \
-        if (max > st->d->prev_sample_peak[c]) {                                \
-          st->d->prev_sample_peak[c] = max;                                    \
-        }                                                                      \
+    for (l = 0; l < (lanes); ++l) {                                            \
+      for (i = 1; i < FILTER_STATE_SIZE; ++i) {                                \
+        state[i][l] = st->d->v[c + l][i];                                      \
       }                                                                        \
+      weight[l] = ebur128_channel_weight(st->d->channel_map[c + l]);           \
+      energy[l] = st->d->channel_energy[c + l];                                \
     }                                                                          \
-    if ((st->mode & EBUR128_MODE_TRUE_PEAK) == EBUR128_MODE_TRUE_PEAK &&       \
-        st->d->interp) {                                                       \
-      for (i = 0; i < frames; ++i) {                                           \
-        for (c = 0; c < st->channels; ++c) {                                   \
-          st->d->resampler_buffer_input[i * st->channels + c] =                \
-              (float) ((double) src[i * st->channels + c] / scaling_factor);   \
-        }                                                                      \
-      }                                                                        \
-      ebur128_check_true_peak(st, frames);                                     \
+    v1 = loadu(state[1]);                                                      \
+    v2 = loadu(state[2]);                                                      \
+    v3 = loadu(state[3]);                                                      \
+    v4 = loadu(state[4]);                                                      \
+    w = loadu(weight);                                                         \
+    e = loadu(energy);                                                         \
+    for (i = 0; i < frames; ++i) {                                             \
+      double* x = tile + i * stride + c;                                       \
+      v0 = sub(sub(sub(sub(loadu(x), mul(a1, v1)), mul(a2, v2)),               \
+                   mul(a3, v3)),                                               \
+               mul(a4, v4));                                                   \
+      y = add(add(add(add(mul(b0, v0), mul(b1, v1)), mul(b2, v2)),             \
+                  mul(b3, v3)),                                                \
+              mul(b4, v4));                                                    \
+      y = mul(mul(y, y), w);                                                   \
+      storeu(x, y);                                                            \
+      e = add(e, y);                                                           \
+      v4 = v3;                                                                 \
+      v3 = v2;                                                                 \
+      v2 = v1;                                                                 \
+      v1 = v0;                                                                 \
     }                                                                          \
-    for (c = 0; c < st->channels; ++c) {                                       \
-      if (st->d->channel_map[c] == EBUR128_UNUSED) {                           \
-        continue;                                                              \
-      }                                                                        \
-      for (i = 0; i < frames; ++i) {                                           \
-        st->d->v[c][0] =                                                       \
-            (double) ((double) src[i * st->channels + c] / scaling_factor) -   \
-            st->d->a[1] * st->d->v[c][1] - /**/                                \
-            st->d->a[2] * st->d->v[c][2] - /**/                                \
-            st->d->a[3] * st->d->v[c][3] - /**/                                \
-            st->d->a[4] * st->d->v[c][4];                                      \
-        audio_data[i * st->channels + c] = /**/                                \
-            st->d->b[0] * st->d->v[c][0] + /**/                                \
-            st->d->b[1] * st->d->v[c][1] + /**/                                \
-            st->d->b[2] * st->d->v[c][2] + /**/                                \
-            st->d->b[3] * st->d->v[c][3] + /**/                                \
-            st->d->b[4] * st->d->v[c][4];                                      \
-        st->d->v[c][4] = st->d->v[c][3];                                       \
-        st->d->v[c][3] = st->d->v[c][2];                                       \
-        st->d->v[c][2] = st->d->v[c][1];                                       \
-        st->d->v[c][1] = st->d->v[c][0];                                       \
+    storeu(state[1], v1);                                                      \
+    storeu(state[2], v2);                                                      \
+    storeu(state[3], v3);                                                      \
+    storeu(state[4], v4);                                                      \
+    storeu(energy, e);                                                         \
+    /* Channels that are not used keep their old filter state. */              \
+    for (l = 0; l < (lanes); ++l) {                                            \
+      if (st->d->channel_map[c + l] != EBUR128_UNUSED) {                       \
+        st->d->v[c + l][0] = state[1][l];                                      \
+        for (i = 1; i < FILTER_STATE_SIZE; ++i) {                              \
+          st->d->v[c + l][i] = state[i][l];                                    \
+        }                                                                      \
+        st->d->channel_energy[c + l] = energy[l];                              \
       }                                                                        \
-      FLUSH_MANUALLY                                                           \
     }                                                                          \
-    TURN_OFF_FTZ                                                               \
   }
 
-EBUR128_FILTER(short, SHRT_MIN, SHRT_MAX)
-EBUR128_FILTER(int, INT_MIN, INT_MAX)
-EBUR128_FILTER(float, -1.0f, 1.0f)
-EBUR128_FILTER(double, -1.0, 1.0)
+#ifdef EBUR128_HAVE_SSE2
+EBUR128_FILTER_LANES(ebur128_filter_sse2, EBUR128_TARGET("sse2"), 2, __m128d,
+                     _mm_set1_pd, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd,
+                     _mm_sub_pd, _mm_mul_pd)
+#endif
+#ifdef EBUR128_HAVE_AVX2
+EBUR128_FILTER_LANES(ebur128_filter_avx2, EBUR128_TARGET("avx2"), 4, __m256d,
+                     _mm256_set1_pd, _mm256_loadu_pd, _mm256_storeu_pd,
+                     _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd)
+#endif
+#ifdef EBUR128_HAVE_AVX512
+EBUR128_FILTER_LANES(ebur128_filter_avx512, EBUR128_TARGET("avx512f"), 8,
+                     __m512d, _mm512_set1_pd, _mm512_loadu_pd,
+                     _mm512_storeu_pd, _mm512_add_pd, _mm512_sub_pd,
+                     _mm512_mul_pd)
+#endif
 
-static double ebur128_energy_to_loudness(double energy) {
-  return 10 * (log(energy) / log(10.0)) - 0.691;
+/* Returns non-zero if any of the channels [c, c + lanes) is used. */
+static int ebur128_lanes_used(ebur128_state* st, size_t c, size_t lanes) {
+  size_t l;
+  for (l = 0; l < lanes; ++l) {
+    if (st->d->channel_map[c + l] != EBUR128_UNUSED) {
+      return 1;
+    }
+  }
+  return 0;
 }
 
-static size_t find_histogram_index(double energy) {
-  size_t index_min = 0;
-  size_t index_max = 1000;
-  size_t index_mid;
-
-  do {
-    index_mid = (index_min + index_max) / 2;
-    if (energy >= histogram_energy_boundaries[index_mid]) {
-      index_min = index_mid;
-    } else {
-      index_max = index_mid;
+/* Filters all channels of a tile, using the widest kernel that fits. */
+static void ebur128_filter_tile(ebur128_state* st,
+                                double* tile,
+                                size_t stride,
+                                size_t frames) {
+  size_t c = 0;
+#ifdef EBUR128_HAVE_AVX512
+  for (; simd_level >= EBUR128_SIMD_AVX512 && c + 8 <= st->channels; c += 8) {
+    if (ebur128_lanes_used(st, c, 8)) {
+      ebur128_filter_avx512(st, tile, stride, frames, c);
     }
-  } while (index_max - index_min != 1);
+  }
+#endif
+#ifdef EBUR128_HAVE_AVX2
+  for (; simd_level >= EBUR128_SIMD_AVX2 && c + 4 <= st->channels; c += 4) {
+    if (ebur128_lanes_used(st, c, 4)) {
+      ebur128_filter_avx2(st, tile, stride, frames, c);
+    }
+  }
+#endif
+#ifdef EBUR128_HAVE_SSE2
+  for (; simd_level >= EBUR128_SIMD_SSE2 && c + 2 <= st->channels; c += 2) {
+    if (ebur128_lanes_used(st, c, 2)) {
+      ebur128_filter_sse2(st, tile, stride, frames, c);
+    }
+  }
+#endif
+  for (; c < st->channels; ++c) {
+    if (ebur128_lanes_used(st, c, 1)) {
+      ebur128_filter_channel(st, tile, stride, frames, c);
+    }
+  }
+}
 
-  return index_min;
+/* In EBUR128_MODE_TRUE_PEAK_SKIP, returns non-zero if interpolating the
+ * current tile of channel c can't change the reported true peaks, given that
+ * its largest absolute sample is "max". Only the peaks of the current call,
+ * and of the current block if blocks are reported, are compared, as those
+ * are the smallest peaks the tile ends up in. "true_peak" and
+ * "block_true_peak" hold the true peaks of the call and of the block so far,
+ * "sample_peak" and "block_sample_peak" the sample peaks up to the end of
+ * the tile. */
+static int ebur128_true_peak_bounded(ebur128_state* st,
+                                     size_t c,
+                                     double max,
+                                     const double* true_peak,
+                                     const double* sample_peak,
+                                     const double* block_true_peak,
+                                     const double* block_sample_peak) {
+  double bound;
+
+  if ((st->mode & EBUR128_MODE_TRUE_PEAK_SKIP) != EBUR128_MODE_TRUE_PEAK_SKIP) {
+    return 0;
+  }
+  /* the true peaks are reported as at least the sample peaks */
+  bound = interp_bound(st->d->interp, (unsigned int) c, max);
+  if (bound > EBUR128_MAX(true_peak[c], sample_peak[c])) {
+    return 0;
+  }
+  return !block_sample_peak ||
+         bound <= EBUR128_MAX(block_true_peak[c], block_sample_peak[c]);
 }
 
-static int ebur128_calc_gating_block(ebur128_state* st,
-                                     size_t frames_per_block,
-                                     double* optional_output) {
-  size_t i, c;
-  double sum = 0.0;
-  double channel_sum;
+/* Interpolates a tile of interleaved samples into the true peaks of the call
+ * and, if not NULL, of the block, or only updates the delay buffers of the
+ * channels whose largest sample "peak" can't raise the reported true peaks.
+ * See ebur128_true_peak_bounded for the other arguments. */
+static void ebur128_true_peak_tile(ebur128_state* st,
+                                   const float* tile,
+                                   const double* peak,
+                                   double* true_peak,
+                                   const double* sample_peak,
+                                   double* block_true_peak,
+                                   const double* block_sample_peak,
+                                   size_t frames) {
+  size_t c;
   for (c = 0; c < st->channels; ++c) {
-    if (st->d->channel_map[c] == EBUR128_UNUSED) {
-      continue;
+    if (ebur128_true_peak_bounded(st, c, peak[c], true_peak, sample_peak,
+                                  block_true_peak, block_sample_peak)) {
+      interp_skip(st->d->interp, (unsigned int) c, tile + c, st->channels,
+                  frames);
+    } else if (block_true_peak) {
+      /* a block can start in an earlier call */
+      double tile_peak = 0.0;
+      interp_process(st->d->interp, (unsigned int) c, tile + c, st->channels,
+                     frames, &tile_peak);
+      true_peak[c] = EBUR128_MAX(true_peak[c], tile_peak);
+      block_true_peak[c] = EBUR128_MAX(block_true_peak[c], tile_peak);
+    } else {
+      interp_process(st->d->interp, (unsigned int) c, tile + c, st->channels,
+                     frames, &true_peak[c]);
     }
-    channel_sum = 0.0;
-    if (st->d->audio_data_index < frames_per_block * st->channels) {
-      for (i = 0; i < st->d->audio_data_index / st->channels; ++i) {
-        channel_sum += st->d->audio_data[i * st->channels + c] *
-                       st->d->audio_data[i * st->channels + c];
+  }
+  interp_advance(st->d->interp, frames);
+}
+
+/* Slots of the true peak queue, one of which is always empty. */
+#define EBUR128_TRUE_PEAK_SLOTS 8
+
+/* A tile of samples for the true peak worker, see ebur128_filter_*. */
+struct ebur128_true_peak_chunk {
+  float samples[EBUR128_TILE_SIZE];
+  /* Largest absolute sample of each channel in the tile. */
+  double peak[VALIDATE_MAX_CHANNELS];
+  /* Sample peak of each channel in the call and in the block up to the end
+   * of the tile, only set in EBUR128_MODE_TRUE_PEAK_SKIP. The block peaks
+   * only while blocks are reported. */
+  double sample_peak[VALIDATE_MAX_CHANNELS];
+  double block_sample_peak[VALIDATE_MAX_CHANNELS];
+  size_t frames;
+  /* Non-zero for the first tile of an ebur128_add_frames_* call. */
+  int start;
+  /* Non-zero if block_sample_peak is set. */
+  int blocks;
+  /* Counts the blocks of the state, see ebur128_true_peak_worker. */
+  unsigned long block;
+  /* Set by the worker: the true peaks of the call and of the block up to the
+   * end of the tile. */
+  double true_peak[VALIDATE_MAX_CHANNELS];
+  double block_true_peak[VALIDATE_MAX_CHANNELS];
+};
+
+/* A block that is reported once the worker has interpolated its last tile,
+ * see ebur128_report_block. */
+struct ebur128_pending_block {
+  unsigned long index;
+  double momentary;
+  double shortterm;
+  double sample_peak[VALIDATE_MAX_CHANNELS];
+  /* True peaks of the tiles that were interpolated on the calling thread. */
+  double true_peak[VALIDATE_MAX_CHANNELS];
+  /* The block is complete once this many tiles are collected. */
+  unsigned long tiles;
+};
+
+/* Interpolates the tiles queued by ebur128_filter_* on its own thread. Until
+ * ebur128_true_peak_worker_sync, the worker owns the interpolator. It keeps
+ * its own true peaks, which the calling thread collects from the tiles, so
+ * that the state is never written by both. */
+struct ebur128_true_peak_worker {
+  ebur128_state* st;
+  ebur128_thread thread;
+  ebur128_mutex lock;
+  ebur128_cond wake; /* a tile was queued, or quit is set */
+  ebur128_cond done; /* a tile was interpolated */
+  /* The queued tiles are the slots from head up to tail. Only the worker
+   * writes head, only the thread adding frames writes tail. */
+  ebur128_atomic head;
+  ebur128_atomic tail;
+  /* Set while the worker waits on wake, or the other thread on done. */
+  ebur128_atomic worker_waiting;
+  ebur128_atomic producer_waiting;
+  int quit;
+  struct ebur128_true_peak_chunk chunks[EBUR128_TRUE_PEAK_SLOTS];
+  /* Only used by the worker: the true peaks of the call and of the block so
+   * far, and the block of the last tile. */
+  double true_peak[VALIDATE_MAX_CHANNELS];
+  double block_true_peak[VALIDATE_MAX_CHANNELS];
+  unsigned long block;
+  /* Only used by the thread adding frames. */
+  int start; /* the next queued tile is the first of a call */
+  unsigned long pushed;    /* tiles queued so far */
+  unsigned long collected; /* tiles whose peaks are in the state */
+  unsigned long blocks;    /* blocks completed, the block of the next tile */
+  /* Block and block true peaks of the last collected tile. */
+  unsigned long collected_block;
+  double collected_block_peak[VALIDATE_MAX_CHANNELS];
+  /* Completed blocks whose last tile is not collected yet, oldest first.
+   * There are fewer than there are tiles in the queue. */
+  struct ebur128_pending_block pending[EBUR128_TRUE_PEAK_SLOTS];
+  unsigned int pending_first;
+  unsigned int pending_used;
+};
+
+EBUR128_THREAD_FUNC(ebur128_true_peak_worker_main, arg) {
+  struct ebur128_true_peak_worker* w = (struct ebur128_true_peak_worker*) arg;
+  ebur128_state* st = w->st;
+  ebur128_atomic head = 0;
+  size_t c;
+  TURN_ON_FTZ
+
+  for (;;) {
+    struct ebur128_true_peak_chunk* chunk = &w->chunks[head];
+    if (ebur128_atomic_load(&w->tail) == head) {
+      int quit;
+      ebur128_mutex_lock(&w->lock);
+      ebur128_atomic_store(&w->worker_waiting, 1);
+      while (ebur128_atomic_load(&w->tail) == head && !w->quit) {
+        ebur128_cond_wait(&w->wake, &w->lock);
       }
-      for (i = st->d->audio_data_frames -
-               (frames_per_block - st->d->audio_data_index / st->channels);
-           i < st->d->audio_data_frames; ++i) {
-        channel_sum += st->d->audio_data[i * st->channels + c] *
-                       st->d->audio_data[i * st->channels + c];
+      ebur128_atomic_store(&w->worker_waiting, 0);
+      quit = w->quit;
+      ebur128_mutex_unlock(&w->lock);
+      if (quit) {
+        break;
       }
-    } else {
-      for (i = st->d->audio_data_index / st->channels - frames_per_block;
-           i < st->d->audio_data_index / st->channels; ++i) {
-        channel_sum += st->d->audio_data[i * st->channels + c] *
-                       st->d->audio_data[i * st->channels + c];
+    }
+    for (c = 0; c < st->channels; ++c) {
+      if (chunk->start) {
+        w->true_peak[c] = 0.0;
+      }
+      if (chunk->block != w->block) {
+        w->block_true_peak[c] = 0.0;
       }
     }
-    if (st->d->channel_map[c] == EBUR128_Mp110 ||
-        st->d->channel_map[c] == EBUR128_Mm110 ||
-        st->d->channel_map[c] == EBUR128_Mp060 ||
-        st->d->channel_map[c] == EBUR128_Mm060 ||
-        st->d->channel_map[c] == EBUR128_Mp090 ||
-        st->d->channel_map[c] == EBUR128_Mm090) {
-      channel_sum *= 1.41;
-    } else if (st->d->channel_map[c] == EBUR128_DUAL_MONO) {
-      channel_sum *= 2.0;
+    w->block = chunk->block;
+    ebur128_true_peak_tile(st, chunk->samples, chunk->peak, w->true_peak,
+                           chunk->sample_peak, w->block_true_peak,
+                           chunk->blocks ? chunk->block_sample_peak : NULL,
+                           chunk->frames);
+    memcpy(chunk->true_peak, w->true_peak, st->channels * sizeof(double));
+    memcpy(chunk->block_true_peak, w->block_true_peak,
+           st->channels * sizeof(double));
+    head = (head + 1) % EBUR128_TRUE_PEAK_SLOTS;
+    ebur128_atomic_store(&w->head, head);
+    if (ebur128_atomic_load(&w->producer_waiting)) {
+      ebur128_mutex_lock(&w->lock);
+      ebur128_cond_broadcast(&w->done);
+      ebur128_mutex_unlock(&w->lock);
     }
-    sum += channel_sum;
   }
+  TURN_OFF_FTZ
+  EBUR128_THREAD_RETURN;
+}
 
-  sum /= (double) frames_per_block;
+/* Waits until the worker has interpolated all queued tiles, or, if "drain"
+ * is zero, until there is a free slot. */
+static void ebur128_true_peak_worker_wait(struct ebur128_true_peak_worker* w,
+                                          int drain) {
+  ebur128_atomic busy =
+      drain ? w->tail : (w->tail + 1) % EBUR128_TRUE_PEAK_SLOTS;
 
-  if (optional_output) {
-    *optional_output = sum;
-    return EBUR128_SUCCESS;
+  if (drain ? ebur128_atomic_load(&w->head) == busy
+            : ebur128_atomic_load(&w->head) != busy) {
+    return;
   }
+  ebur128_mutex_lock(&w->lock);
+  ebur128_atomic_store(&w->producer_waiting, 1);
+  while (drain ? ebur128_atomic_load(&w->head) != busy
+               : ebur128_atomic_load(&w->head) == busy) {
+    ebur128_cond_wait(&w->done, &w->lock);
+  }
+  ebur128_atomic_store(&w->producer_waiting, 0);
+  ebur128_mutex_unlock(&w->lock);
+}
 
-  if (sum >= histogram_energy_boundaries[0]) {
-    if (st->d->use_histogram) {
-      ++st->d->block_energy_histogram[find_histogram_index(sum)];
-    } else {
-      struct ebur128_dq_entry* block;
-      if (st->d->block_list_size == st->d->block_list_max) {
-        block = STAILQ_FIRST(&st->d->block_list);
-        STAILQ_REMOVE_HEAD(&st->d->block_list, entries);
-      } else {
-        block =
-            (struct ebur128_dq_entry*) malloc(sizeof(struct ebur128_dq_entry));
-        if (!block) {
-          return EBUR128_ERROR_NOMEM;
-        }
-        st->d->block_list_size++;
+static void ebur128_report_pending_block(const ebur128_state* st);
+
+/* Folds the peaks of the tiles that the worker has interpolated into the
+ * true peaks of st, as ebur128_true_peak_tile does without a worker, and
+ * reports the blocks that they complete. Does not wait for the worker. */
+static void ebur128_true_peak_worker_collect(const ebur128_state* st) {
+  struct ebur128_true_peak_worker* w = st->d->true_peak_worker;
+  ebur128_atomic head = ebur128_atomic_load(&w->head);
+  size_t c;
+
+  while ((ebur128_atomic) (w->collected % EBUR128_TRUE_PEAK_SLOTS) != head) {
+    const struct ebur128_true_peak_chunk* chunk =
+        &w->chunks[w->collected % EBUR128_TRUE_PEAK_SLOTS];
+    for (c = 0; c < st->channels; ++c) {
+      if (chunk->start && st->d->prev_true_peak[c] > st->d->true_peak[c]) {
+        st->d->true_peak[c] = st->d->prev_true_peak[c];
       }
-      block->z = sum;
-      STAILQ_INSERT_TAIL(&st->d->block_list, block, entries);
+      st->d->prev_true_peak[c] = chunk->true_peak[c];
+      w->collected_block_peak[c] = chunk->block_true_peak[c];
+    }
+    w->collected_block = chunk->block;
+    ++w->collected;
+    if (w->pending_used > 0 &&
+        w->pending[w->pending_first].tiles == w->collected) {
+      ebur128_report_pending_block(st);
+    }
+  }
+}
+
+/* Returns the slot for the next tile, waiting for the worker if the queue is
+ * full. */
+static struct ebur128_true_peak_chunk*
+ebur128_true_peak_worker_acquire(ebur128_state* st) {
+  struct ebur128_true_peak_worker* w = st->d->true_peak_worker;
+  ebur128_true_peak_worker_wait(w, 0);
+  /* the slot may hold peaks that were not collected yet */
+  ebur128_true_peak_worker_collect(st);
+  return &w->chunks[w->tail];
+}
+
+/* Queues the tile of the last ebur128_true_peak_worker_acquire. */
+static void ebur128_true_peak_worker_push(ebur128_state* st,
+                                          struct ebur128_true_peak_chunk* chunk,
+                                          size_t frames) {
+  struct ebur128_true_peak_worker* w = st->d->true_peak_worker;
+  size_t c;
+
+  chunk->frames = frames;
+  chunk->start = w->start;
+  chunk->blocks = st->d->block_sample_peak != NULL;
+  chunk->block = w->blocks;
+  w->start = 0;
+  ++w->pushed;
+  if ((st->mode & EBUR128_MODE_TRUE_PEAK_SKIP) == EBUR128_MODE_TRUE_PEAK_SKIP) {
+    for (c = 0; c < st->channels; ++c) {
+      chunk->sample_peak[c] = st->d->prev_sample_peak[c];
+      if (st->d->block_sample_peak) {
+        chunk->block_sample_peak[c] = st->d->block_sample_peak[c];
+      }
+    }
+  }
+  ebur128_atomic_store(&w->tail, (w->tail + 1) % EBUR128_TRUE_PEAK_SLOTS);
+  if (ebur128_atomic_load(&w->worker_waiting)) {
+    ebur128_mutex_lock(&w->lock);
+    ebur128_cond_broadcast(&w->wake);
+    ebur128_mutex_unlock(&w->lock);
+  }
+}
+
+/* Waits for the worker and folds its results into the true peaks of st, as
+ * ebur128_add_frames_* does at the end of each call without a worker. */
+static void ebur128_true_peak_worker_sync(const ebur128_state* st) {
+  struct ebur128_true_peak_worker* w = st->d->true_peak_worker;
+  size_t c;
+
+  if (!w) {
+    return;
+  }
+  ebur128_true_peak_worker_wait(w, 1);
+  ebur128_true_peak_worker_collect(st);
+  for (c = 0; c < st->channels; ++c) {
+    if (st->d->prev_true_peak[c] > st->d->true_peak[c]) {
+      st->d->true_peak[c] = st->d->prev_true_peak[c];
+    }
+    /* the rest of the block may be interpolated without the worker */
+    if (st->d->block_true_peak && w->collected_block == w->blocks &&
+        w->collected_block_peak[c] > st->d->block_true_peak[c]) {
+      st->d->block_true_peak[c] = w->collected_block_peak[c];
+    }
+    /* the last call queued no tiles */
+    if (w->start) {
+      st->d->prev_true_peak[c] = 0.0;
+    }
+  }
+  w->start = 0;
+}
+
+/* Reports the blocks that wait for the worker, so that each block is
+ * reported by the call that completes it. */
+static void ebur128_true_peak_worker_flush(ebur128_state* st) {
+  struct ebur128_true_peak_worker* w = st->d->true_peak_worker;
+
+  if (w && w->pending_used > 0) {
+    ebur128_true_peak_worker_wait(w, 1);
+    ebur128_true_peak_worker_collect(st);
+  }
+}
+
+static void ebur128_true_peak_worker_destroy(ebur128_state* st) {
+  struct ebur128_true_peak_worker* w = st->d->true_peak_worker;
+
+  if (!w) {
+    return;
+  }
+  ebur128_true_peak_worker_sync(st);
+  ebur128_mutex_lock(&w->lock);
+  w->quit = 1;
+  ebur128_cond_broadcast(&w->wake);
+  ebur128_mutex_unlock(&w->lock);
+  ebur128_thread_join(w->thread);
+  ebur128_cond_destroy(&w->done);
+  ebur128_cond_destroy(&w->wake);
+  ebur128_mutex_destroy(&w->lock);
+  free(w);
+  st->d->true_peak_worker = NULL;
+}
+
+/* Sample loaders for the packed formats. The integer formats are loaded as
+ * signed values, without depending on the byte order of the host. */
+#define EBUR128_LOAD_NATIVE(p) (*(p))
+
+static int ebur128_load_u8(const unsigned char* p) {
+  return (int) *p - 0x80;
+}
+
+static long ebur128_load_s16be(const unsigned char* p) {
+  return ((long) (p[0] ^ 0x80) << 8 | (long) p[1]) - 0x8000L;
+}
+
+static long ebur128_load_s24le(const unsigned char* p) {
+  return ((long) (p[2] ^ 0x80) << 16 | (long) p[1] << 8 | (long) p[0]) -
+         0x800000L;
+}
+
+static long ebur128_load_s24be(const unsigned char* p) {
+  return ((long) (p[0] ^ 0x80) << 16 | (long) p[1] << 8 | (long) p[2]) -
+         0x800000L;
+}
+
+static long ebur128_load_s24in32(const int* p) {
+  return (((long) *p & 0xffffffL) ^ 0x800000L) - 0x800000L;
+}
+
+static double ebur128_load_s32be(const unsigned char* p) {
+  return (double) ((unsigned long) (p[0] ^ 0x80) << 24 |
+                   (unsigned long) p[1] << 16 | (unsigned long) p[2] << 8 |
+                   (unsigned long) p[3]) -
+         2147483648.0;
+}
+
+static float ebur128_load_f32be(const unsigned char* p) {
+  const unsigned short one = 1;
+  unsigned char b[sizeof(float)];
+  float f;
+  if (*(const unsigned char*) &one) {
+    b[0] = p[3];
+    b[1] = p[2];
+    b[2] = p[1];
+    b[3] = p[0];
+  } else {
+    memcpy(b, p, sizeof(b));
+  }
+  memcpy(&f, b, sizeof(f));
+  return f;
+}
+
+/* Per sample format entry points for ebur128_add_frames_parallel. */
+struct ebur128_format {
+  /* Filters "frames" frames starting at frame "offset" of src. */
+  void (*filter)(ebur128_state* st,
+                 const void* const* src,
+                 size_t stride,
+                 size_t offset,
+                 size_t frames,
+                 double* frame_energy);
+  /* Loads the true peak delay buffers with the frames before "offset". */
+  void (*prime)(ebur128_state* st,
+                const void* const* src,
+                size_t stride,
+                size_t offset);
+};
+
+/* Converts each tile of the input in a single pass, which also finds the
+ * sample peaks and stages the samples for the true peak interpolator. All
+ * scaling factors are powers of two, so multiplying by the inverse gives the
+ * same results as a division. Sample i of channel c is load(src[c] + i *
+ * src_stride), and src is advanced past the filtered frames. The input is
+ * read one channel at a time, so planar input is read contiguously while the
+ * small tile takes care of interleaving. */
+#define EBUR128_FILTER(format, type, load, min_scale, max_scale)               \
+  static void ebur128_filter_##format(ebur128_state* st, const type** src,     \
+                                      size_t src_stride, size_t frames,        \
+                                      double* frame_energy) {                  \
+    const double scale =                                                       \
+        1.0 / EBUR128_MAX(-((double) (min_scale)), (double) (max_scale));      \
+    double tile[EBUR128_TILE_SIZE];                                            \
+    float tp_tile[EBUR128_TILE_SIZE];                                          \
+    double peak[VALIDATE_MAX_CHANNELS];                                        \
+    size_t stride = st->channels;                                              \
+    size_t tile_frames = EBUR128_TILE_SIZE / stride;                           \
+    size_t streams = st->d->streams;                                           \
+    size_t stream_channels = st->channels / streams;                           \
+    int true_peak = (st->mode & EBUR128_MODE_TRUE_PEAK) ==                     \
+                        EBUR128_MODE_TRUE_PEAK &&                              \
+                    st->d->interp;                                             \
+    int sample_peak = (st->mode & EBUR128_MODE_SAMPLE_PEAK) ==                 \
+                      EBUR128_MODE_SAMPLE_PEAK;                                \
+    struct ebur128_true_peak_worker* worker =                                  \
+        true_peak ? st->d->true_peak_worker : NULL;                            \
+    size_t i, c, k, n;                                                         \
+                                                                               \
+    TURN_ON_FTZ                                                                \
+                                                                               \
+    for (; frames > 0; frames -= n) {                                          \
+      /* with a worker, the tile is staged in its queue */                     \
+      struct ebur128_true_peak_chunk* chunk =                                  \
+          worker ? ebur128_true_peak_worker_acquire(st) : NULL;                \
+      float* tp_stage = chunk ? chunk->samples : tp_tile;                      \
+      double* tp_peak = chunk ? chunk->peak : peak;                            \
+      n = frames < tile_frames ? frames : tile_frames;                         \
+      for (c = 0; c < st->channels; ++c) {                                     \
+        const type* in = src[c];                                               \
+        double* out = tile + c;                                                \
+        double max = 0.0;                                                      \
+        if (true_peak) {                                                       \
+          float* tp_out = tp_stage + c;                                        \
+          for (i = 0; i < n; ++i) {                                            \
+            double x = (double) load(in + i * src_stride) * scale;             \
+            out[i * stride] = x;                                               \
+            tp_out[i * stride] = (float) x;                                    \
+            max = EBUR128_MAX(max, EBUR128_MAX(x, -x));                        \
+          }                                                                    \
+        } else if (sample_peak) {                                              \
+          for (i = 0; i < n; ++i) {                                            \
+            double x = (double) load(in + i * src_stride) * scale;             \
+            out[i * stride] = x;                                               \
+            max = EBUR128_MAX(max, EBUR128_MAX(x, -x));                        \
+          }                                                                    \
+        } else {                                                               \
+          for (i = 0; i < n; ++i) {                                            \
+            out[i * stride] = (double) load(in + i * src_stride) * scale;      \
+          }                                                                    \
+        }                                                                      \
+        tp_peak[c] = max;                                                      \
+        if (max > st->d->prev_sample_peak[c]) {                                \
+          st->d->prev_sample_peak[c] = max;                                    \
+        }                                                                      \
+        if (st->d->block_sample_peak && max > st->d->block_sample_peak[c]) {   \
+          st->d->block_sample_peak[c] = max;                                   \
+        }                                                                      \
+        src[c] += n * src_stride;                                              \
+      }                                                                        \
+      if (chunk) {                                                             \
+        ebur128_true_peak_worker_push(st, chunk, n);                           \
+      } else if (true_peak) {                                                  \
+        ebur128_true_peak_tile(st, tp_tile, peak, st->d->prev_true_peak,       \
+                               st->d->prev_sample_peak,                        \
+                               st->d->block_true_peak,                         \
+                               st->d->block_sample_peak, n);                   \
+      }                                                                        \
+      ebur128_filter_tile(st, tile, stride, n);                                \
+      for (i = 0; i < n; ++i) {                                                \
+        for (k = 0; k < streams; ++k) {                                        \
+          double sum = 0.0;                                                    \
+          for (c = k * stream_channels; c < (k + 1) * stream_channels; ++c) {  \
+            if (st->d->channel_map[c] != EBUR128_UNUSED) {                     \
+              sum += tile[i * stride + c];                                     \
+            }                                                                  \
+          }                                                                    \
+          frame_energy[i * streams + k] = sum;                                 \
+        }                                                                      \
+      }                                                                        \
+      frame_energy += n * streams;                                             \
+    }                                                                          \
+    TURN_OFF_FTZ                                                               \
+  }                                                                            \
+                                                                               \
+  static void ebur128_filter_range_##format(                                   \
+      ebur128_state* st, const void* const* src, size_t stride,                \
+      size_t offset, size_t frames, double* frame_energy) {                    \
+    const type* channels[VALIDATE_MAX_CHANNELS];                               \
+    size_t c;                                                                  \
+    for (c = 0; c < st->channels; ++c) {                                       \
+      channels[c] = (const type*) src[c] + offset * stride;                    \
+    }                                                                          \
+    ebur128_filter_##format(st, channels, stride, frames, frame_energy);       \
+  }                                                                            \
+                                                                               \
+  static void ebur128_prime_##format(ebur128_state* st,                        \
+                                     const void* const* src, size_t stride,    \
+                                     size_t offset) {                          \
+    const double scale =                                                       \
+        1.0 / EBUR128_MAX(-((double) (min_scale)), (double) (max_scale));      \
+    size_t count = st->d->interp->delay;                                       \
+    float last[INTERP_MAX_DELAY];                                              \
+    size_t i, c;                                                               \
+    for (c = 0; c < st->channels; ++c) {                                       \
+      const type* in = (const type*) src[c] + (offset - count) * stride;       \
+      for (i = 0; i < count; ++i) {                                            \
+        last[i] = (float) ((double) load(in + i * stride) * scale);            \
+      }                                                                        \
+      interp_skip(st->d->interp, (unsigned int) c, last, 1, count);            \
+    }                                                                          \
+    interp_advance(st->d->interp, count);                                      \
+  }                                                                            \
+                                                                               \
+  static const struct ebur128_format ebur128_format_##format = {               \
+      ebur128_filter_range_##format, ebur128_prime_##format};
+
+EBUR128_FILTER(short, short, EBUR128_LOAD_NATIVE, SHRT_MIN, SHRT_MAX)
+EBUR128_FILTER(int, int, EBUR128_LOAD_NATIVE, INT_MIN, INT_MAX)
+EBUR128_FILTER(float, float, EBUR128_LOAD_NATIVE, -1.0f, 1.0f)
+EBUR128_FILTER(double, double, EBUR128_LOAD_NATIVE, -1.0, 1.0)
+EBUR128_FILTER(u8, unsigned char, ebur128_load_u8, -0x80, 0x7f)
+EBUR128_FILTER(s16be, unsigned char, ebur128_load_s16be, -0x8000, 0x7fff)
+EBUR128_FILTER(s24le, unsigned char, ebur128_load_s24le, -0x800000, 0x7fffff)
+EBUR128_FILTER(s24be, unsigned char, ebur128_load_s24be, -0x800000, 0x7fffff)
+EBUR128_FILTER(s24in32, int, ebur128_load_s24in32, -0x800000, 0x7fffff)
+EBUR128_FILTER(s32be, unsigned char, ebur128_load_s32be, -2147483648.0,
+               2147483647.0)
+EBUR128_FILTER(f32be, unsigned char, ebur128_load_f32be, -1.0f, 1.0f)
+
+static double ebur128_energy_to_loudness(double energy) {
+  return 10 * (log(energy) / log(10.0)) - 0.691;
+}
+
+static size_t find_histogram_index(double energy) {
+  size_t index_min = 0;
+  size_t index_max = 1000;
+  size_t index_mid;
+
+  do {
+    index_mid = (index_min + index_max) / 2;
+    if (energy >= histogram_energy_boundaries[index_mid]) {
+      index_min = index_mid;
+    } else {
+      index_max = index_mid;
+    }
+  } while (index_max - index_min != 1);
+
+  return index_min;
+}
+
+static int ebur128_energy_in_interval(ebur128_state* st,
+                                      size_t interval_frames,
+                                      double* out);
+
+static int ebur128_calc_gating_block(ebur128_state* st) {
+  double sum;
+
+  ebur128_energy_in_interval(st, st->d->samples_in_100ms * 4, &sum);
+
+  if (sum >= histogram_energy_boundaries[0]) {
+    if (st->d->use_histogram) {
+      ++st->d->block_energy_histogram[find_histogram_index(sum)];
+    } else if (ebur128_list_append(&st->d->block_list, sum)) {
+      return EBUR128_ERROR_NOMEM;
     }
   }
 
@@ -797,274 +2752,1670 @@ int ebur128_change_parameters(ebur128_state* st,
                               unsigned int channels,
                               unsigned long samplerate) {
   int errcode = EBUR128_SUCCESS;
-  size_t j;
 
-  /* This is needed to suppress a clang-tidy warning. */
-#ifndef __has_builtin
-#define __has_builtin(x) 0
-#endif
-#if __has_builtin(__builtin_unreachable)
-  if (st->channels == 0) {
-    __builtin_unreachable();
+  /* This is needed to suppress a clang-tidy warning. */
+#ifndef __has_builtin
+#define __has_builtin(x) 0
+#endif
+#if __has_builtin(__builtin_unreachable)
+  if (st->channels == 0) {
+    __builtin_unreachable();
+  }
+#endif
+
+  VALIDATE_CHANNELS_AND_SAMPLERATE(EBUR128_ERROR_NOMEM);
+
+  /* the interpolator and the true peaks may be replaced */
+  ebur128_true_peak_worker_sync(st);
+
+  if (channels == st->channels && samplerate == st->samplerate) {
+    return EBUR128_ERROR_NO_CHANGE;
+  }
+
+  free(st->d->frame_energy);
+  st->d->frame_energy = NULL;
+  free(st->d->subblock_energy);
+  st->d->subblock_energy = NULL;
+  free(st->d->channel_energy);
+  st->d->channel_energy = NULL;
+
+  if (channels != st->channels) {
+    unsigned int i;
+
+    free(st->d->channel_map);
+    st->d->channel_map = NULL;
+    free(st->d->sample_peak);
+    st->d->sample_peak = NULL;
+    free(st->d->prev_sample_peak);
+    st->d->prev_sample_peak = NULL;
+    free(st->d->true_peak);
+    st->d->true_peak = NULL;
+    free(st->d->prev_true_peak);
+    st->d->prev_true_peak = NULL;
+    st->channels = channels;
+
+    errcode = ebur128_init_channel_map(st);
+    CHECK_ERROR(errcode, EBUR128_ERROR_NOMEM, exit)
+
+    st->d->sample_peak = (double*) malloc(channels * sizeof(double));
+    CHECK_ERROR(!st->d->sample_peak, EBUR128_ERROR_NOMEM, exit)
+    st->d->prev_sample_peak = (double*) malloc(channels * sizeof(double));
+    CHECK_ERROR(!st->d->prev_sample_peak, EBUR128_ERROR_NOMEM, exit)
+    st->d->true_peak = (double*) malloc(channels * sizeof(double));
+    CHECK_ERROR(!st->d->true_peak, EBUR128_ERROR_NOMEM, exit)
+    st->d->prev_true_peak = (double*) malloc(channels * sizeof(double));
+    CHECK_ERROR(!st->d->prev_true_peak, EBUR128_ERROR_NOMEM, exit)
+    for (i = 0; i < channels; ++i) {
+      st->d->sample_peak[i] = 0.0;
+      st->d->prev_sample_peak[i] = 0.0;
+      st->d->true_peak[i] = 0.0;
+      st->d->prev_true_peak[i] = 0.0;
+    }
+  }
+  if (samplerate != st->samplerate) {
+    st->samplerate = samplerate;
+    st->d->samples_in_100ms = (st->samplerate + 5) / 10;
+  }
+
+  /* If we're here, either samplerate or channels
+   * have changed. Re-init filter. */
+  free(st->d->v);
+  st->d->v = NULL;
+  errcode = ebur128_init_filter(st);
+  CHECK_ERROR(errcode, EBUR128_ERROR_NOMEM, exit)
+
+  errcode = ebur128_init_energy(st, st->d->window);
+  CHECK_ERROR(errcode, EBUR128_ERROR_NOMEM, exit)
+  if (st->d->long_window) {
+    ebur128_long_window_reset(st->d->long_window);
+  }
+
+  ebur128_destroy_resampler(st);
+  errcode = ebur128_init_resampler(st);
+  CHECK_ERROR(errcode, EBUR128_ERROR_NOMEM, exit)
+
+exit:
+  return errcode;
+}
+
+int ebur128_set_max_window(ebur128_state* st, unsigned long window) {
+  int errcode = EBUR128_SUCCESS;
+
+  if ((st->mode & EBUR128_MODE_S) == EBUR128_MODE_S && window < 3000) {
+    window = 3000;
+  } else if ((st->mode & EBUR128_MODE_M) == EBUR128_MODE_M && window < 400) {
+    window = 400;
+  }
+
+  if (window == st->d->window) {
+    return EBUR128_ERROR_NO_CHANGE;
+  }
+
+  errcode = ebur128_init_energy(st, window);
+  CHECK_ERROR(errcode, EBUR128_ERROR_NOMEM, exit)
+  st->d->window = window;
+
+exit:
+  return errcode;
+}
+
+int ebur128_set_max_long_window(ebur128_state* st, unsigned long window) {
+  struct ebur128_long_window* long_window = NULL;
+  size_t blocks = window / 100 + (window % 100 != 0);
+  size_t leaves = 1;
+
+  if (blocks == (st->d->long_window ? st->d->long_window->size - 1 : 0)) {
+    return EBUR128_ERROR_NO_CHANGE;
+  }
+  if (blocks > 0) {
+    while (leaves < blocks + 1) {
+      leaves *= 2;
+      if (leaves > ((size_t) -1) / (2 * sizeof(double))) {
+        return EBUR128_ERROR_NOMEM;
+      }
+    }
+    long_window = (struct ebur128_long_window*) calloc(
+        1, sizeof(struct ebur128_long_window));
+    if (!long_window) {
+      return EBUR128_ERROR_NOMEM;
+    }
+    long_window->sum = (double*) calloc(2 * leaves, sizeof(double));
+    if (!long_window->sum) {
+      free(long_window);
+      return EBUR128_ERROR_NOMEM;
+    }
+    long_window->energy = long_window->sum + leaves;
+    long_window->leaves = leaves;
+    long_window->size = blocks + 1;
+  }
+  ebur128_long_window_destroy(st->d->long_window);
+  st->d->long_window = long_window;
+  return EBUR128_SUCCESS;
+}
+
+int ebur128_set_max_history(ebur128_state* st, unsigned long history) {
+  if ((st->mode & EBUR128_MODE_LRA) == EBUR128_MODE_LRA && history < 3000) {
+    history = 3000;
+  } else if ((st->mode & EBUR128_MODE_M) == EBUR128_MODE_M && history < 400) {
+    history = 400;
+  }
+  if (history == st->d->history) {
+    return EBUR128_ERROR_NO_CHANGE;
+  }
+  st->d->history = history;
+  ebur128_list_set_max(&st->d->block_list, st->d->history / 100);
+  ebur128_list_set_max(&st->d->short_term_block_list, st->d->history / 3000);
+  return EBUR128_SUCCESS;
+}
+
+int ebur128_set_threads(ebur128_state* st, unsigned int threads) {
+  unsigned int current = st->d->pool ? st->d->pool->threads : 1;
+
+  if (threads > EBUR128_MAX_THREADS) {
+    threads = EBUR128_MAX_THREADS;
+  } else if (threads == 0) {
+    threads = 1;
+  }
+  if (threads == current) {
+    return EBUR128_ERROR_NO_CHANGE;
+  }
+  ebur128_pool_destroy(st->d->pool);
+  st->d->pool = NULL;
+  if (threads > 1) {
+    st->d->pool = ebur128_pool_create(threads);
+    if (!st->d->pool) {
+      return EBUR128_ERROR_NOMEM;
+    }
+  }
+  return EBUR128_SUCCESS;
+}
+
+int ebur128_set_channel_parts(ebur128_state* st,
+                              unsigned int parts,
+                              ebur128_task_runner run,
+                              void* user) {
+  struct ebur128_channel_parts* p = NULL;
+
+  if (parts > VALIDATE_MAX_CHANNELS) {
+    parts = VALIDATE_MAX_CHANNELS;
+  }
+  if (parts > 1) {
+    p = (struct ebur128_channel_parts*) calloc(
+        1, sizeof(struct ebur128_channel_parts));
+    if (!p) {
+      return EBUR128_ERROR_NOMEM;
+    }
+    p->part = (struct ebur128_channel_part*) calloc(
+        parts, sizeof(struct ebur128_channel_part));
+    if (!p->part) {
+      free(p);
+      return EBUR128_ERROR_NOMEM;
+    }
+    p->count = parts;
+    p->run = run;
+    p->user = user;
+  }
+  ebur128_channel_parts_destroy(st->d->parts);
+  st->d->parts = p;
+  return EBUR128_SUCCESS;
+}
+
+int ebur128_set_true_peak_worker(ebur128_state* st, int enable) {
+  struct ebur128_true_peak_worker* w;
+
+  if ((st->mode & EBUR128_MODE_TRUE_PEAK) != EBUR128_MODE_TRUE_PEAK) {
+    return EBUR128_ERROR_INVALID_MODE;
+  }
+  if (!enable == !st->d->true_peak_worker) {
+    return EBUR128_ERROR_NO_CHANGE;
+  }
+  if (!enable) {
+    ebur128_true_peak_worker_destroy(st);
+    return EBUR128_SUCCESS;
+  }
+
+  w = (struct ebur128_true_peak_worker*) calloc(
+      1, sizeof(struct ebur128_true_peak_worker));
+  if (!w) {
+    goto exit;
+  }
+  w->st = st;
+  if (ebur128_mutex_init(&w->lock)) {
+    goto free_worker;
+  }
+  if (ebur128_cond_init(&w->wake)) {
+    goto free_lock;
+  }
+  if (ebur128_cond_init(&w->done)) {
+    goto free_wake;
+  }
+  if (ebur128_thread_start(&w->thread, ebur128_true_peak_worker_main, w)) {
+    goto free_done;
+  }
+  st->d->true_peak_worker = w;
+  return EBUR128_SUCCESS;
+
+free_done:
+  ebur128_cond_destroy(&w->done);
+free_wake:
+  ebur128_cond_destroy(&w->wake);
+free_lock:
+  ebur128_mutex_destroy(&w->lock);
+free_worker:
+  free(w);
+exit:
+  return EBUR128_ERROR_NOMEM;
+}
+
+int ebur128_start_chunk(ebur128_state* st,
+                        unsigned long first_block,
+                        size_t preroll) {
+  if (st->d->blocks > 0 || st->d->needed_frames != st->d->samples_in_100ms) {
+    return EBUR128_ERROR_INVALID_MODE;
+  }
+  st->d->first_block = first_block;
+  st->d->preroll = preroll;
+  /* keep the short term blocks on the grid of the whole stream */
+  st->d->short_term_frame_counter =
+      (first_block % 10) * st->d->samples_in_100ms;
+  return EBUR128_SUCCESS;
+}
+
+static int ebur128_energy_shortterm(ebur128_state* st, double* out);
+
+/* Stores the energy of a completed 100ms block and calculates new gating and
+ * short term blocks, if enabled by "gating" and "short_term". */
+static int ebur128_store_subblock(ebur128_state* st,
+                                  double sum,
+                                  int gating,
+                                  int short_term) {
+  st->d->subblock_energy[st->d->subblock_index] = sum;
+  if (++st->d->subblock_index == st->d->subblocks) {
+    st->d->subblock_index = 0;
+  }
+  if (st->d->subblocks_filled < st->d->subblocks) {
+    ++st->d->subblocks_filled;
+  }
+  st->d->needed_frames = st->d->samples_in_100ms;
+
+  /* calculate the new gating block */
+  if (gating && (st->mode & EBUR128_MODE_I) == EBUR128_MODE_I &&
+      st->d->subblocks_filled >= 4) {
+    if (ebur128_calc_gating_block(st)) {
+      return EBUR128_ERROR_NOMEM;
+    }
+  }
+  if ((st->mode & EBUR128_MODE_LRA) == EBUR128_MODE_LRA &&
+      st->d->short_term_frame_counter == st->d->samples_in_100ms * 30) {
+    double st_energy;
+    /* a chunk that starts between two short term blocks has less than 3s
+     * at its first one, ebur128_merge calculates it */
+    if (short_term && st->d->subblocks_filled >= 30 &&
+        ebur128_energy_shortterm(st, &st_energy) == EBUR128_SUCCESS &&
+        st_energy >= histogram_energy_boundaries[0]) {
+      if (st->d->use_histogram) {
+        ++st->d->short_term_block_energy_histogram[find_histogram_index(
+            st_energy)];
+      } else if (ebur128_list_append(&st->d->short_term_block_list,
+                                     st_energy)) {
+        return EBUR128_ERROR_NOMEM;
+      }
+    }
+    st->d->short_term_frame_counter = st->d->samples_in_100ms * 20;
+  }
+
+  return EBUR128_SUCCESS;
+}
+
+/* An ebur128_snapshot as 64 bit words: the blocks, then the bits of the
+ * doubles in the order of the struct. */
+#define EBUR128_SNAPSHOT_WORDS (6 + 2 * EBUR128_SNAPSHOT_CHANNELS)
+
+/* A snapshot behind a seqlock: the sequence is odd while it is written. The
+ * same layout is used in memory of ebur128_shared_init, which processes of
+ * different word sizes may share. All fields have the same size everywhere
+ * and are aligned to their size, so that there is no padding. */
+struct ebur128_published_snapshot {
+  ebur128_atomic32 sequence;
+  uint32_t reserved;
+  ebur128_word values[EBUR128_SNAPSHOT_WORDS];
+};
+
+/* Collects the current meter values of st, including the peaks of the
+ * current ebur128_add_frames_* call. Values that the mode does not provide
+ * are -HUGE_VAL, or 0.0 for peaks. This runs for every block, so the values
+ * that go through all blocks so far are only collected where they are kept
+ * up to date as blocks are added. */
+static void ebur128_fill_snapshot(ebur128_state* st, ebur128_snapshot* out) {
+  int incremental =
+      st->d->use_histogram || (st->mode & EBUR128_MODE_INCREMENTAL);
+  unsigned int c;
+
+  out->blocks = st->d->first_block + st->d->blocks;
+  if (ebur128_loudness_momentary(st, &out->momentary)) {
+    out->momentary = -HUGE_VAL;
+  }
+  if (ebur128_loudness_shortterm(st, &out->shortterm)) {
+    out->shortterm = -HUGE_VAL;
+  }
+  if (!incremental || ebur128_loudness_global(st, &out->global)) {
+    out->global = -HUGE_VAL;
+  }
+  if (!incremental || ebur128_loudness_range(st, &out->loudness_range)) {
+    out->loudness_range = -HUGE_VAL;
+  }
+  if (!incremental ||
+      ebur128_relative_threshold(st, &out->relative_threshold)) {
+    out->relative_threshold = -HUGE_VAL;
+  }
+  /* the tiles that the worker is still interpolating are left out */
+  if (st->d->true_peak_worker) {
+    ebur128_true_peak_worker_collect(st);
+  }
+  for (c = 0; c < EBUR128_SNAPSHOT_CHANNELS; ++c) {
+    double sample_peak = 0.0;
+    double true_peak = 0.0;
+    if (c < st->channels &&
+        (st->mode & EBUR128_MODE_SAMPLE_PEAK) == EBUR128_MODE_SAMPLE_PEAK) {
+      sample_peak =
+          EBUR128_MAX(st->d->sample_peak[c], st->d->prev_sample_peak[c]);
+    }
+    if (c < st->channels &&
+        (st->mode & EBUR128_MODE_TRUE_PEAK) == EBUR128_MODE_TRUE_PEAK) {
+      true_peak = EBUR128_MAX(st->d->true_peak[c], st->d->prev_true_peak[c]);
+      true_peak = EBUR128_MAX(true_peak, sample_peak);
+    }
+    out->sample_peak[c] = sample_peak;
+    out->true_peak[c] = true_peak;
+  }
+}
+
+static void ebur128_pack_snapshot(const ebur128_snapshot* values,
+                                  ebur128_word* words) {
+  words[0] = (ebur128_word) values->blocks;
+  memcpy(&words[1], &values->momentary, sizeof(double));
+  memcpy(&words[2], &values->shortterm, sizeof(double));
+  memcpy(&words[3], &values->global, sizeof(double));
+  memcpy(&words[4], &values->loudness_range, sizeof(double));
+  memcpy(&words[5], &values->relative_threshold, sizeof(double));
+  memcpy(&words[6], values->sample_peak, sizeof(values->sample_peak));
+  memcpy(&words[6 + EBUR128_SNAPSHOT_CHANNELS], values->true_peak,
+         sizeof(values->true_peak));
+}
+
+static void ebur128_unpack_snapshot(const ebur128_word* words,
+                                    ebur128_snapshot* out) {
+  out->blocks = (unsigned long) words[0];
+  memcpy(&out->momentary, &words[1], sizeof(double));
+  memcpy(&out->shortterm, &words[2], sizeof(double));
+  memcpy(&out->global, &words[3], sizeof(double));
+  memcpy(&out->loudness_range, &words[4], sizeof(double));
+  memcpy(&out->relative_threshold, &words[5], sizeof(double));
+  memcpy(out->sample_peak, &words[6], sizeof(out->sample_peak));
+  memcpy(out->true_peak, &words[6 + EBUR128_SNAPSHOT_CHANNELS],
+         sizeof(out->true_peak));
+}
+
+static void ebur128_write_snapshot(struct ebur128_published_snapshot* snapshot,
+                                   const ebur128_snapshot* values) {
+  uint32_t sequence = (uint32_t) ebur128_atomic_load(&snapshot->sequence);
+  ebur128_word words[EBUR128_SNAPSHOT_WORDS];
+  size_t i;
+
+  ebur128_pack_snapshot(values, words);
+  ebur128_atomic_store(&snapshot->sequence,
+                       (ebur128_atomic32) ((sequence + 1) & 0x7fffffffUL));
+  ebur128_atomic_fence();
+  for (i = 0; i < EBUR128_SNAPSHOT_WORDS; ++i) {
+    ebur128_word_store(&snapshot->values[i], words[i]);
+  }
+  ebur128_atomic_store(&snapshot->sequence,
+                       (ebur128_atomic32) ((sequence + 2) & 0x7fffffffUL));
+}
+
+/* Retries while the snapshot is written, so readers are lock-free, but not
+ * wait-free. */
+static void ebur128_read_snapshot(struct ebur128_published_snapshot* snapshot,
+                                  ebur128_snapshot* out) {
+  ebur128_word words[EBUR128_SNAPSHOT_WORDS];
+  ebur128_atomic32 sequence;
+  size_t i;
+
+  do {
+    sequence = ebur128_atomic_load(&snapshot->sequence);
+    for (i = 0; i < EBUR128_SNAPSHOT_WORDS; ++i) {
+      words[i] = ebur128_word_load(&snapshot->values[i]);
+    }
+    ebur128_atomic_fence();
+  } while ((sequence & 1) ||
+           ebur128_atomic_load(&snapshot->sequence) != sequence);
+  ebur128_unpack_snapshot(words, out);
+}
+
+static void ebur128_publish_snapshot(ebur128_state* st) {
+  ebur128_snapshot values;
+
+  ebur128_fill_snapshot(st, &values);
+  if (st->d->snapshot) {
+    ebur128_write_snapshot(st->d->snapshot, &values);
+  }
+  if (st->d->shared) {
+    ebur128_write_snapshot(st->d->shared, &values);
+  }
+}
+
+/* Passes a completed block to the block callback. The true peaks are raised
+ * to the sample peaks, or set to 0.0 without EBUR128_MODE_TRUE_PEAK. */
+static void ebur128_call_block_callback(const ebur128_state* st,
+                                        ebur128_block* block,
+                                        const double* sample_peak,
+                                        double* true_peak) {
+  int has_true_peak =
+      (st->mode & EBUR128_MODE_TRUE_PEAK) == EBUR128_MODE_TRUE_PEAK;
+  unsigned int c;
+
+  for (c = 0; c < st->channels; ++c) {
+    true_peak[c] =
+        has_true_peak ? EBUR128_MAX(true_peak[c], sample_peak[c]) : 0.0;
+  }
+  block->sample_peak = sample_peak;
+  block->true_peak = true_peak;
+  st->d->block_callback(st->d->block_user, block);
+}
+
+/* Reports the oldest pending block, whose last tile was just collected. */
+static void ebur128_report_pending_block(const ebur128_state* st) {
+  struct ebur128_true_peak_worker* w = st->d->true_peak_worker;
+  struct ebur128_pending_block* p = &w->pending[w->pending_first];
+  ebur128_block block;
+  unsigned int c;
+
+  block.index = p->index;
+  block.momentary = p->momentary;
+  block.shortterm = p->shortterm;
+  for (c = 0; c < st->channels; ++c) {
+    p->true_peak[c] = EBUR128_MAX(p->true_peak[c], w->collected_block_peak[c]);
+  }
+  ebur128_call_block_callback(st, &block, p->sample_peak, p->true_peak);
+  w->pending_first = (w->pending_first + 1) % EBUR128_TRUE_PEAK_SLOTS;
+  --w->pending_used;
+}
+
+/* Passes the block that was just completed to the block callback, and
+ * starts the peaks of the next one. If the true peak worker has not
+ * interpolated all of its tiles yet, the block is kept until
+ * ebur128_true_peak_worker_collect gets to its last tile. */
+static void ebur128_report_block(ebur128_state* st) {
+  struct ebur128_true_peak_worker* w = st->d->true_peak_worker;
+  ebur128_block block;
+  unsigned int c;
+
+  block.index = st->d->first_block + st->d->blocks - 1;
+  if (ebur128_energy_in_interval(st, st->d->samples_in_100ms * 4,
+                                 &block.momentary)) {
+    block.momentary = 0.0;
+  }
+  if (ebur128_energy_in_interval(st, st->d->samples_in_100ms * 30,
+                                 &block.shortterm)) {
+    block.shortterm = 0.0;
+  }
+  if (w && w->collected != w->pushed) {
+    struct ebur128_pending_block* p =
+        &w->pending[(w->pending_first + w->pending_used) %
+                    EBUR128_TRUE_PEAK_SLOTS];
+    p->index = block.index;
+    p->momentary = block.momentary;
+    p->shortterm = block.shortterm;
+    memcpy(p->sample_peak, st->d->block_sample_peak,
+           st->channels * sizeof(double));
+    memcpy(p->true_peak, st->d->block_true_peak,
+           st->channels * sizeof(double));
+    p->tiles = w->pushed;
+    ++w->pending_used;
+  } else {
+    if (w && w->collected_block == w->blocks) {
+      /* tiles of the block were interpolated by the worker */
+      for (c = 0; c < st->channels; ++c) {
+        st->d->block_true_peak[c] = EBUR128_MAX(st->d->block_true_peak[c],
+                                                w->collected_block_peak[c]);
+      }
+    }
+    ebur128_call_block_callback(st, &block, st->d->block_sample_peak,
+                                st->d->block_true_peak);
+  }
+  for (c = 0; c < st->channels; ++c) {
+    st->d->block_sample_peak[c] = 0.0;
+    st->d->block_true_peak[c] = 0.0;
+  }
+}
+
+/* Points of ebur128_set_timeline, two floats each. */
+struct ebur128_timeline {
+  float* points;
+  size_t used;
+  size_t size;
+  /** Whether points was allocated here and may grow. */
+  int own;
+  unsigned int hop;
+};
+
+static void ebur128_timeline_destroy(struct ebur128_timeline* timeline) {
+  if (timeline && timeline->own) {
+    free(timeline->points);
+  }
+  free(timeline);
+}
+
+/* Appends a point, growing the points if they were allocated here. */
+static int ebur128_timeline_append(struct ebur128_timeline* timeline,
+                                   float momentary,
+                                   float shortterm) {
+  if (timeline->used == timeline->size) {
+    size_t size = timeline->size ? 2 * timeline->size : 64;
+    float* points;
+    if (!timeline->own) {
+      return EBUR128_SUCCESS;
+    }
+    points = (float*) realloc(timeline->points, 2 * size * sizeof(float));
+    if (!points) {
+      return EBUR128_ERROR_NOMEM;
+    }
+    timeline->points = points;
+    timeline->size = size;
+  }
+  timeline->points[2 * timeline->used] = momentary;
+  timeline->points[2 * timeline->used + 1] = shortterm;
+  ++timeline->used;
+  return EBUR128_SUCCESS;
+}
+
+/* Appends a point if "blocks" blocks of the stream are complete now and
+ * that ends a hop. */
+static int ebur128_record_timeline(ebur128_state* st, unsigned long blocks) {
+  double momentary, shortterm;
+
+  if (blocks % st->d->timeline->hop != 0) {
+    return EBUR128_SUCCESS;
+  }
+  if (ebur128_loudness_momentary(st, &momentary)) {
+    momentary = -HUGE_VAL;
+  }
+  if (ebur128_loudness_shortterm(st, &shortterm)) {
+    shortterm = -HUGE_VAL;
+  }
+  return ebur128_timeline_append(st->d->timeline, (float) momentary,
+                                 (float) shortterm);
+}
+
+/* Called after the last frame of a 100ms block has been filtered. */
+static int ebur128_end_subblock(ebur128_state* st) {
+  double sum = 0.0;
+  size_t c;
+
+  for (c = 0; c < st->channels; ++c) {
+    sum += st->d->channel_energy[c];
+    st->d->channel_energy[c] = 0.0;
+  }
+  if (st->d->blocks < EBUR128_HEAD_BLOCKS) {
+    st->d->head_energy[st->d->blocks] = sum;
+  }
+  ++st->d->blocks;
+  if (ebur128_store_subblock(st, sum, 1, 1)) {
+    return EBUR128_ERROR_NOMEM;
+  }
+  if (st->d->long_window) {
+    ebur128_long_window_add(st->d->long_window, sum);
+  }
+  if (st->d->snapshot || st->d->shared) {
+    ebur128_publish_snapshot(st);
+  }
+  if (st->d->block_callback) {
+    ebur128_report_block(st);
+  }
+  if (st->d->true_peak_worker) {
+    ++st->d->true_peak_worker->blocks;
+  }
+  if (st->d->timeline &&
+      ebur128_record_timeline(st, st->d->first_block + st->d->blocks)) {
+    return EBUR128_ERROR_NOMEM;
+  }
+  return EBUR128_SUCCESS;
+}
+
+int ebur128_set_timeline(ebur128_state* st,
+                         unsigned int hop,
+                         float* points,
+                         size_t size) {
+  struct ebur128_timeline* timeline = NULL;
+
+  if (hop > 0) {
+    timeline =
+        (struct ebur128_timeline*) calloc(1, sizeof(struct ebur128_timeline));
+    if (!timeline) {
+      return EBUR128_ERROR_NOMEM;
+    }
+    timeline->points = points;
+    timeline->size = points ? size : 0;
+    timeline->own = points == NULL;
+    timeline->hop = hop;
+  }
+  ebur128_timeline_destroy(st->d->timeline);
+  st->d->timeline = timeline;
+  return EBUR128_SUCCESS;
+}
+
+size_t ebur128_get_timeline(const ebur128_state* st, const float** points) {
+  if (!st->d->timeline) {
+    *points = NULL;
+    return 0;
+  }
+  *points = st->d->timeline->points;
+  return st->d->timeline->used;
+}
+
+int ebur128_set_block_callback(ebur128_state* st,
+                               ebur128_block_callback callback,
+                               void* user) {
+  if (callback && !st->d->block_sample_peak) {
+    st->d->block_sample_peak =
+        (double*) calloc(2 * VALIDATE_MAX_CHANNELS, sizeof(double));
+    if (!st->d->block_sample_peak) {
+      return EBUR128_ERROR_NOMEM;
+    }
+  }
+  st->d->block_callback = callback;
+  st->d->block_user = user;
+  if (callback) {
+    st->d->block_true_peak = st->d->block_sample_peak + VALIDATE_MAX_CHANNELS;
+  } else {
+    free(st->d->block_sample_peak);
+    st->d->block_sample_peak = NULL;
+    st->d->block_true_peak = NULL;
+  }
+  return EBUR128_SUCCESS;
+}
+
+int ebur128_set_snapshot(ebur128_state* st, int enable) {
+  if (!enable == !st->d->snapshot) {
+    return EBUR128_ERROR_NO_CHANGE;
+  }
+  if (!enable) {
+    free(st->d->snapshot);
+    st->d->snapshot = NULL;
+    return EBUR128_SUCCESS;
+  }
+  st->d->snapshot = (struct ebur128_published_snapshot*) calloc(
+      1, sizeof(struct ebur128_published_snapshot));
+  if (!st->d->snapshot) {
+    return EBUR128_ERROR_NOMEM;
+  }
+  ebur128_publish_snapshot(st);
+  return EBUR128_SUCCESS;
+}
+
+int ebur128_get_snapshot(const ebur128_state* st, ebur128_snapshot* out) {
+  if (!st->d->snapshot) {
+    return EBUR128_ERROR_INVALID_MODE;
+  }
+  ebur128_read_snapshot(st->d->snapshot, out);
+  return EBUR128_SUCCESS;
+}
+
+/* Layout of the shared memory of ebur128_shared_init: the header, followed
+ * by one slot per stream. The magic reads "EBUR" in memory on any host.
+ * Readers check it, the version and the sizes, so that only processes with
+ * the same layout use the memory, whatever their word size. The other
+ * fields are in host byte order, which a mismatch of the sizes detects. */
+#define EBUR128_SHARED_VERSION 2
+
+struct ebur128_shared_header {
+  unsigned char magic[4];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t slot_size;
+  uint32_t streams;
+  uint32_t reserved;
+};
+
+static const unsigned char ebur128_shared_magic[4] = { 'E', 'B', 'U', 'R' };
+
+static struct ebur128_published_snapshot*
+ebur128_shared_slot(const void* memory, unsigned int stream) {
+  const struct ebur128_shared_header* header =
+      (const struct ebur128_shared_header*) memory;
+
+  if (memcmp(header->magic, ebur128_shared_magic, 4) != 0) {
+    return NULL;
+  }
+  /* the rest of the header was written before the magic */
+  ebur128_atomic_fence();
+  if (header->version != EBUR128_SHARED_VERSION ||
+      header->header_size != sizeof(struct ebur128_shared_header) ||
+      header->slot_size != sizeof(struct ebur128_published_snapshot) ||
+      stream >= header->streams) {
+    return NULL;
+  }
+  return (struct ebur128_published_snapshot*) (header + 1) + stream;
+}
+
+size_t ebur128_shared_size(unsigned int streams) {
+  return sizeof(struct ebur128_shared_header) +
+         streams * sizeof(struct ebur128_published_snapshot);
+}
+
+void ebur128_shared_init(void* memory, unsigned int streams) {
+  struct ebur128_shared_header* header =
+      (struct ebur128_shared_header*) memory;
+  struct ebur128_published_snapshot* slots =
+      (struct ebur128_published_snapshot*) (header + 1);
+  ebur128_snapshot empty;
+  unsigned int i, c;
+
+  empty.blocks = 0;
+  empty.momentary = -HUGE_VAL;
+  empty.shortterm = -HUGE_VAL;
+  empty.global = -HUGE_VAL;
+  empty.loudness_range = -HUGE_VAL;
+  empty.relative_threshold = -HUGE_VAL;
+  for (c = 0; c < EBUR128_SNAPSHOT_CHANNELS; ++c) {
+    empty.sample_peak[c] = 0.0;
+    empty.true_peak[c] = 0.0;
+  }
+  memset(memory, 0, ebur128_shared_size(streams));
+  for (i = 0; i < streams; ++i) {
+    ebur128_pack_snapshot(&empty, slots[i].values);
+  }
+  header->version = EBUR128_SHARED_VERSION;
+  header->header_size = sizeof(struct ebur128_shared_header);
+  header->slot_size = sizeof(struct ebur128_published_snapshot);
+  header->streams = streams;
+  /* readers only use the memory once the magic is there */
+  ebur128_atomic_fence();
+  memcpy(header->magic, ebur128_shared_magic, 4);
+}
+
+int ebur128_set_shared(ebur128_state* st, void* memory, unsigned int stream) {
+  struct ebur128_published_snapshot* slot = NULL;
+
+  if (memory) {
+    slot = ebur128_shared_slot(memory, stream);
+    if (!slot) {
+      return EBUR128_ERROR_INVALID_MODE;
+    }
+  }
+  st->d->shared = slot;
+  if (slot) {
+    ebur128_publish_snapshot(st);
+  }
+  return EBUR128_SUCCESS;
+}
+
+int ebur128_get_shared(const void* memory,
+                       unsigned int stream,
+                       ebur128_snapshot* out) {
+  struct ebur128_published_snapshot* slot =
+      ebur128_shared_slot(memory, stream);
+
+  if (!slot) {
+    return EBUR128_ERROR_INVALID_MODE;
+  }
+  ebur128_read_snapshot(slot, out);
+  return EBUR128_SUCCESS;
+}
+
+/* Appends the entries of src to dst, oldest first. */
+static int ebur128_list_append_list(struct ebur128_double_list* dst,
+                                    const struct ebur128_double_list* src) {
+  size_t i, j;
+  for (i = 0; i < src->size; ++i) {
+    j = src->start + i;
+    if (j >= src->capacity) {
+      j -= src->capacity;
+    }
+    if (ebur128_list_append(dst, src->z[j])) {
+      return EBUR128_ERROR_NOMEM;
+    }
+  }
+  return EBUR128_SUCCESS;
+}
+
+int ebur128_merge(ebur128_state* dst, const ebur128_state* src) {
+  struct ebur128_state_internal* d = dst->d;
+  const struct ebur128_state_internal* s = src->d;
+  size_t samples_in_100ms = d->samples_in_100ms;
+  int full = s->subblocks_filled == s->subblocks;
+  size_t blocks, i, c;
+  unsigned long k;
+
+  ebur128_true_peak_worker_sync(dst);
+  ebur128_true_peak_worker_sync(src);
+  if (dst->channels != src->channels || dst->samplerate != src->samplerate ||
+      dst->mode != src->mode || d->subblocks != s->subblocks ||
+      d->needed_frames != samples_in_100ms || s->preroll > 0 ||
+      d->first_block + d->blocks != s->first_block ||
+      (d->long_window ? d->long_window->size : 0) !=
+          (s->long_window ? s->long_window->size : 0) ||
+      (d->timeline ? d->timeline->hop : 0) !=
+          (s->timeline ? s->timeline->hop : 0)) {
+    return EBUR128_ERROR_INVALID_MODE;
+  }
+
+  /* Add the first blocks of src to dst, which calculates the gating and
+   * short term blocks that start in dst. All later ones are in src. */
+  blocks = full ? EBUR128_MIN(s->blocks, EBUR128_HEAD_BLOCKS)
+                : s->subblocks_filled;
+  for (i = 0; i < blocks; ++i) {
+    double energy = full ? s->head_energy[i] : s->subblock_energy[i];
+    if (!full) {
+      memcpy(d->frame_energy + d->subblock_index * samples_in_100ms,
+             s->frame_energy + i * samples_in_100ms,
+             samples_in_100ms * sizeof(double));
+    }
+    if (d->blocks + i < EBUR128_HEAD_BLOCKS) {
+      d->head_energy[d->blocks + i] = energy;
+    }
+    if ((dst->mode & EBUR128_MODE_LRA) == EBUR128_MODE_LRA) {
+      d->short_term_frame_counter += samples_in_100ms;
+    }
+    if (ebur128_store_subblock(dst, energy, i < 3, i < 29)) {
+      return EBUR128_ERROR_NOMEM;
+    }
+    if (d->timeline &&
+        ebur128_record_timeline(dst, s->first_block + (unsigned long) i + 1)) {
+      return EBUR128_ERROR_NOMEM;
+    }
+  }
+  /* the windows of all later points are within src */
+  if (d->timeline) {
+    const struct ebur128_timeline* timeline = s->timeline;
+    i = s->first_block / timeline->hop;
+    i = (s->first_block + blocks) / timeline->hop - i;
+    for (; i < timeline->used; ++i) {
+      if (ebur128_timeline_append(d->timeline, timeline->points[2 * i],
+                                  timeline->points[2 * i + 1])) {
+        return EBUR128_ERROR_NOMEM;
+      }
+    }
+  }
+  if (full) {
+    memcpy(d->subblock_energy, s->subblock_energy,
+           s->subblocks * sizeof(double));
+    memcpy(d->frame_energy, s->frame_energy,
+           s->subblocks * samples_in_100ms * sizeof(double));
+    d->subblock_index = s->subblock_index;
+    d->subblocks_filled = s->subblocks_filled;
+  } else {
+    memcpy(d->frame_energy + d->subblock_index * samples_in_100ms,
+           s->frame_energy + s->subblock_index * samples_in_100ms,
+           (samples_in_100ms - s->needed_frames) * sizeof(double));
+  }
+
+  if (d->use_histogram) {
+    for (i = 0; i < 1000; ++i) {
+      d->block_energy_histogram[i] += s->block_energy_histogram[i];
+    }
+    if ((dst->mode & EBUR128_MODE_LRA) == EBUR128_MODE_LRA) {
+      for (i = 0; i < 1000; ++i) {
+        d->short_term_block_energy_histogram[i] +=
+            s->short_term_block_energy_histogram[i];
+      }
+    }
+  } else if (ebur128_list_append_list(&d->block_list, &s->block_list) ||
+             ebur128_list_append_list(&d->short_term_block_list,
+                                      &s->short_term_block_list)) {
+    return EBUR128_ERROR_NOMEM;
+  }
+
+  /* the blocks of src follow the ones of dst, older ones of src are outside
+   * of the longest window */
+  if (d->long_window) {
+    const struct ebur128_long_window* lw = s->long_window;
+    for (i = 0; i < lw->filled; ++i) {
+      ebur128_long_window_add(
+          d->long_window,
+          lw->energy[(lw->index + lw->size - lw->filled + i) % lw->size]);
+    }
+  }
+
+  /* continue where src stopped */
+  d->blocks += s->blocks;
+  d->needed_frames = s->needed_frames;
+  k = d->first_block % 10 + d->blocks;
+  d->short_term_frame_counter =
+      (k < 30 ? k : 20 + k % 10) * samples_in_100ms +
+      (samples_in_100ms - s->needed_frames);
+  memcpy(d->channel_energy, s->channel_energy,
+         dst->channels * sizeof(double));
+  memcpy(d->v, s->v, dst->channels * sizeof(filter_state));
+  if (d->interp) {
+    for (c = 0; c < dst->channels; ++c) {
+      memcpy(d->interp->z[c], s->interp->z[c],
+             d->interp->delay * 2 * sizeof(float));
+    }
+    d->interp->zi = s->interp->zi;
+  }
+  for (c = 0; c < dst->channels; ++c) {
+    d->sample_peak[c] = EBUR128_MAX(d->sample_peak[c], s->sample_peak[c]);
+    d->true_peak[c] = EBUR128_MAX(d->true_peak[c], s->true_peak[c]);
+    d->prev_sample_peak[c] = s->prev_sample_peak[c];
+    d->prev_true_peak[c] = s->prev_true_peak[c];
+  }
+  if (d->snapshot || d->shared) {
+    ebur128_publish_snapshot(dst);
+  }
+  return EBUR128_SUCCESS;
+}
+
+/* A run of complete 100ms blocks, split evenly into one segment per worker,
+ * none shorter than EBUR128_MIN_SEGMENT_BLOCKS. Block 0 completes the current
+ * block of the state. */
+struct ebur128_parallel_job {
+  ebur128_state* st;
+  const struct ebur128_format* format;
+  const void* const* src;
+  size_t stride;
+  size_t offset;       /* first frame of the run in src */
+  size_t blocks;       /* number of blocks */
+  size_t first_frames; /* frames in block 0 */
+  size_t segments;
+  int phase;
+};
+
+/* Returns the offset of a block from the start of the run. */
+static size_t ebur128_parallel_offset(const struct ebur128_parallel_job* job,
+                                      size_t block) {
+  if (block == 0) {
+    return 0;
+  }
+  return job->first_frames + (block - 1) * job->st->d->samples_in_100ms;
+}
+
+/* Returns the first block of segment k, or the number of blocks for
+ * k == job->segments. */
+static size_t ebur128_segment_begin(const struct ebur128_parallel_job* job,
+                                    size_t k) {
+  return k * job->blocks / job->segments;
+}
+
+/* Filters the blocks of segment k, or only its first EBUR128_SETTLE_BLOCKS
+ * in phase 1. The per-channel energy of each block is kept for
+ * ebur128_add_frames_parallel, and the frame energies of the blocks that end
+ * up in the ring buffer are written to it. */
+static void ebur128_parallel_filter(struct ebur128_parallel_job* job,
+                                    unsigned int k) {
+  ebur128_state* st = job->st;
+  struct ebur128_worker* w = &st->d->pool->workers[k];
+  size_t samples_in_100ms = st->d->samples_in_100ms;
+  size_t begin = ebur128_segment_begin(job, k);
+  size_t end = ebur128_segment_begin(job, k + 1);
+  size_t b, c;
+
+  if (job->phase == 1) {
+    end = EBUR128_MIN(end, begin + EBUR128_SETTLE_BLOCKS);
+  }
+  for (b = begin; b < end; ++b) {
+    size_t n = b == 0 ? job->first_frames : samples_in_100ms;
+    double* frame_energy = w->frame_energy;
+    if (b + st->d->subblocks >= job->blocks) {
+      frame_energy = st->d->frame_energy +
+                     (st->d->subblock_index + b) % st->d->subblocks *
+                         samples_in_100ms +
+                     (samples_in_100ms - n);
+    }
+    for (c = 0; c < st->channels; ++c) {
+      w->channel_energy[c] = b == 0 ? st->d->channel_energy[c] : 0.0;
+    }
+    job->format->filter(&w->st, job->src, job->stride,
+                        job->offset + ebur128_parallel_offset(job, b), n,
+                        frame_energy);
+    memcpy(st->d->pool->block_energy + b * st->channels, w->channel_energy,
+           st->channels * sizeof(double));
+  }
+}
+
+/* In phase 0, segment 0 is filtered from the state of st, and all other
+ * segments from silence. The peaks are exact already, as the interpolators
+ * are loaded with the frames before each segment. In phase 1, the first
+ * blocks of the other segments are filtered again, from the state at the
+ * end of the previous segment. The rest of each segment has forgotten its
+ * start state by then. */
+static void ebur128_parallel_run(void* arg, unsigned int k) {
+  struct ebur128_parallel_job* job = (struct ebur128_parallel_job*) arg;
+  struct ebur128_worker* w = &job->st->d->pool->workers[k];
+
+  if (k >= job->segments || (k == 0 && job->phase == 1)) {
+    return;
+  }
+  if (k > 0 && job->phase == 0 && w->d.interp) {
+    size_t begin = ebur128_segment_begin(job, k);
+    job->format->prime(&w->st, job->src, job->stride,
+                       job->offset + ebur128_parallel_offset(job, begin));
+  }
+  ebur128_parallel_filter(job, k);
+}
+
+/* Filters as many complete 100ms blocks of the input as can be split among
+ * the worker threads, see ebur128_parallel_run, and sets *used to the number
+ * of frames used. The peaks are exact, the energies and filter states only
+ * differ from the single threaded ones by rounding. */
+static int ebur128_add_frames_parallel(ebur128_state* st,
+                                       const struct ebur128_format* format,
+                                       const void* const* src,
+                                       size_t stride,
+                                       size_t frames,
+                                       size_t* used) {
+  struct ebur128_pool* pool = st->d->pool;
+  size_t samples_in_100ms = st->d->samples_in_100ms;
+  int true_peak = (st->mode & EBUR128_MODE_TRUE_PEAK) ==
+                      EBUR128_MODE_TRUE_PEAK &&
+                  st->d->interp;
+  struct ebur128_parallel_job job;
+  size_t k, b, c, i;
+
+  *used = 0;
+  if (samples_in_100ms < INTERP_MAX_DELAY || ebur128_pool_prepare(st)) {
+    /* leave it to the single threaded code */
+    return EBUR128_SUCCESS;
+  }
+  job.st = st;
+  job.format = format;
+  job.src = src;
+  job.stride = stride;
+  job.offset = 0;
+  while (frames - job.offset >= st->d->needed_frames) {
+    job.first_frames = st->d->needed_frames;
+    job.blocks = 1 + (frames - job.offset - job.first_frames) /
+                         samples_in_100ms;
+    job.blocks =
+        EBUR128_MIN(job.blocks, pool->threads * EBUR128_MAX_SEGMENT_BLOCKS);
+    job.segments = EBUR128_MIN(pool->threads,
+                               job.blocks / EBUR128_MIN_SEGMENT_BLOCKS);
+    if (job.segments < 2) {
+      break;
+    }
+
+    for (k = 0; k < job.segments; ++k) {
+      struct ebur128_worker* w = &pool->workers[k];
+      w->st = *st;
+      w->d = *st->d;
+      w->st.d = &w->d;
+      w->d.true_peak_worker = NULL;
+      w->d.v = w->v;
+      w->d.channel_energy = w->channel_energy;
+      w->d.prev_sample_peak = w->prev_sample_peak;
+      w->d.prev_true_peak = w->prev_true_peak;
+      w->d.interp = k == 0 ? st->d->interp : true_peak ? w->interp : NULL;
+      for (c = 0; c < st->channels; ++c) {
+        w->prev_sample_peak[c] = 0.0;
+        w->prev_true_peak[c] = 0.0;
+        for (i = 0; i < FILTER_STATE_SIZE; ++i) {
+          w->v[c][i] = k == 0 ? st->d->v[c][i] : 0.0;
+        }
+      }
+    }
+    job.phase = 0;
+    ebur128_pool_run(pool, ebur128_parallel_run, &job);
+
+    for (c = 0; c < st->channels; ++c) {
+      if (st->d->channel_map[c] != EBUR128_UNUSED) {
+        memcpy(st->d->v[c], pool->workers[job.segments - 1].v[c],
+               sizeof(filter_state));
+      }
+    }
+    /* each segment starts where the previous one ended, only the energies
+     * are left to redo */
+    for (k = job.segments - 1; k > 0; --k) {
+      memcpy(pool->workers[k].v, pool->workers[k - 1].v,
+             st->channels * sizeof(filter_state));
+      pool->workers[k].st.mode = EBUR128_MODE_M;
+    }
+    job.phase = 1;
+    ebur128_pool_run(pool, ebur128_parallel_run, &job);
+
+    for (c = 0; c < st->channels; ++c) {
+      for (k = 0; k < job.segments; ++k) {
+        st->d->prev_sample_peak[c] = EBUR128_MAX(
+            st->d->prev_sample_peak[c], pool->workers[k].prev_sample_peak[c]);
+        st->d->prev_true_peak[c] = EBUR128_MAX(
+            st->d->prev_true_peak[c], pool->workers[k].prev_true_peak[c]);
+      }
+    }
+    job.offset += ebur128_parallel_offset(&job, job.blocks);
+    if (true_peak) {
+      format->prime(st, src, stride, job.offset);
+    }
+    for (b = 0; b < job.blocks; ++b) {
+      size_t n = b == 0 ? job.first_frames : samples_in_100ms;
+      memcpy(st->d->channel_energy, pool->block_energy + b * st->channels,
+             st->channels * sizeof(double));
+      if ((st->mode & EBUR128_MODE_LRA) == EBUR128_MODE_LRA) {
+        st->d->short_term_frame_counter += n;
+      }
+      st->d->needed_frames -= (unsigned long) n;
+      if (ebur128_end_subblock(st)) {
+        *used = job.offset;
+        return EBUR128_ERROR_NOMEM;
+      }
+    }
+    *used = job.offset;
+  }
+  return EBUR128_SUCCESS;
+}
+
+static void ebur128_channel_parts_task(void* arg, unsigned int index) {
+  struct ebur128_channel_parts* parts = (struct ebur128_channel_parts*) arg;
+  struct ebur128_channel_part* p = &parts->part[index];
+  parts->format->filter(&p->st, parts->src + p->first, parts->stride, 0,
+                        parts->frames, p->frame_energy);
+}
+
+/* Runs the parts on the threads of ebur128_set_threads, which may be fewer
+ * than the parts. */
+static void ebur128_channel_parts_pool_job(void* arg, unsigned int index) {
+  struct ebur128_channel_parts* parts = (struct ebur128_channel_parts*) arg;
+  unsigned int k;
+  for (k = index; k < parts->used; k += parts->pool->threads) {
+    ebur128_channel_parts_task(parts, k);
+  }
+}
+
+/* Filters the channel parts of st in parallel, see ebur128_set_channel_parts,
+ * and sums the energy of each frame in channel order, as ebur128_filter_*
+ * does. */
+static void ebur128_filter_parts(ebur128_state* st,
+                                 const struct ebur128_format* format,
+                                 const void* const* src,
+                                 size_t stride,
+                                 size_t frames,
+                                 double* frame_energy) {
+  struct ebur128_channel_parts* parts = st->d->parts;
+  size_t i, j, k;
+
+  parts->format = format;
+  parts->src = src;
+  parts->stride = stride;
+  parts->frames = frames;
+  if (parts->run) {
+    parts->run(parts->user, ebur128_channel_parts_task, parts, parts->used);
+  } else if (st->d->pool) {
+    parts->pool = st->d->pool;
+    ebur128_pool_run(st->d->pool, ebur128_channel_parts_pool_job, parts);
+  } else {
+    for (k = 0; k < parts->used; ++k) {
+      ebur128_channel_parts_task(parts, (unsigned int) k);
+    }
+  }
+  if (st->d->interp) {
+    st->d->interp->zi = parts->part[0].interp.zi;
+  }
+
+  for (i = 0; i < frames; ++i) {
+    double sum = 0.0;
+    for (k = 0; k < parts->used; ++k) {
+      const struct ebur128_channel_part* p = &parts->part[k];
+      for (j = 0; j < p->st.channels; ++j) {
+        sum += p->frame_energy[i * p->st.channels + j];
+      }
+    }
+    frame_energy[i] = sum;
+  }
+}
+
+/* Filters up to st->d->preroll frames to set up the filter and interpolator
+ * states of a chunk, see ebur128_start_chunk. Returns the number of frames
+ * used. */
+static size_t ebur128_add_preroll(ebur128_state* st,
+                                  const struct ebur128_format* format,
+                                  const void* const* src,
+                                  size_t stride,
+                                  size_t frames) {
+  ebur128_state tmp = *st;
+  struct ebur128_state_internal d = *st->d;
+  double sample_peak[VALIDATE_MAX_CHANNELS];
+  double true_peak[VALIDATE_MAX_CHANNELS];
+  size_t offset, n, c;
+
+  frames = EBUR128_MIN(frames, st->d->preroll);
+  /* only the true peak interpolator has to run, the peaks are dropped */
+  tmp.d = &d;
+  tmp.mode &= EBUR128_MODE_TRUE_PEAK;
+  d.true_peak_worker = NULL;
+  d.block_sample_peak = NULL;
+  d.block_true_peak = NULL;
+  d.prev_sample_peak = sample_peak;
+  d.prev_true_peak = true_peak;
+  for (c = 0; c < st->channels; ++c) {
+    sample_peak[c] = 0.0;
+    true_peak[c] = 0.0;
+  }
+  for (offset = 0; offset < frames; offset += n) {
+    n = EBUR128_MIN(frames - offset, st->d->samples_in_100ms);
+    format->filter(&tmp, src, stride, offset, n,
+                   st->d->frame_energy +
+                       st->d->subblock_index * st->d->samples_in_100ms);
+  }
+  for (c = 0; c < st->channels; ++c) {
+    st->d->channel_energy[c] = 0.0;
+  }
+  st->d->preroll -= frames;
+  return frames;
+}
+
+/* Adds frames whose channel c starts at src[c], with "stride" elements of
+ * "type" between consecutive frames. */
+#define EBUR128_ADD_FRAMES_CHANNELS(format, type)                              \
+  static int ebur128_add_frames_channels_##format(                             \
+      ebur128_state* st, const type** src, size_t stride, size_t frames) {     \
+    unsigned int c = 0;                                                        \
+    /* the true peak worker is only used by calls on this thread alone */      \
+    int pipelined = st->d->true_peak_worker && st->d->preroll == 0 &&          \
+                    !st->d->pool && !st->d->parts;                             \
+    if (st->d->true_peak_worker && !pipelined) {                               \
+      ebur128_true_peak_worker_sync(st);                                       \
+    }                                                                          \
+    for (c = 0; c < st->channels; c++) {                                       \
+      st->d->prev_sample_peak[c] = 0.0;                                        \
+      if (!pipelined) {                                                        \
+        st->d->prev_true_peak[c] = 0.0;                                        \
+      }                                                                        \
+    }                                                                          \
+    if (pipelined) {                                                           \
+      st->d->true_peak_worker->start = 1;                                      \
+    }                                                                          \
+    if (st->d->parts && ebur128_channel_parts_prepare(st)) {                   \
+      return EBUR128_ERROR_NOMEM;                                              \
+    }                                                                          \
+    if (st->d->preroll > 0 || st->d->pool) {                                   \
+      const void* channels[VALIDATE_MAX_CHANNELS];                             \
+      size_t used = 0;                                                         \
+      int errcode = EBUR128_SUCCESS;                                           \
+      for (c = 0; c < st->channels; c++) {                                     \
+        channels[c] = src[c];                                                  \
+      }                                                                        \
+      if (st->d->preroll > 0) {                                                \
+        used = ebur128_add_preroll(st, &ebur128_format_##format, channels,     \
+                                   stride, frames);                            \
+        for (c = 0; c < st->channels; c++) {                                   \
+          channels[c] = src[c] + used * stride;                                \
+        }                                                                      \
+      }                                                                        \
+      /* blocks are only reported in order by the serial path */               \
+      if (st->d->pool && !st->d->parts && !st->d->block_callback &&            \
+          frames > used) {                                                     \
+        size_t parallel;                                                       \
+        errcode = ebur128_add_frames_parallel(st, &ebur128_format_##format,    \
+                                              channels, stride,                \
+                                              frames - used, &parallel);       \
+        used += parallel;                                                      \
+      }                                                                        \
+      for (c = 0; c < st->channels; c++) {                                     \
+        src[c] += used * stride;                                               \
+      }                                                                        \
+      frames -= used;                                                          \
+      if (errcode) {                                                           \
+        return errcode;                                                        \
+      }                                                                        \
+    }                                                                          \
+    while (frames > 0) {                                                       \
+      /* never filter across the end of a 100ms block */                       \
+      size_t n = st->d->needed_frames;                                         \
+      double* frame_energy = st->d->frame_energy +                             \
+                             (st->d->subblock_index + 1) *                     \
+                                 st->d->samples_in_100ms -                     \
+                             st->d->needed_frames;                             \
+      if (n > frames) {                                                        \
+        n = frames;                                                            \
+      }                                                                        \
+      if (st->d->parts) {                                                      \
+        const void* channels[VALIDATE_MAX_CHANNELS];                           \
+        for (c = 0; c < st->channels; c++) {                                   \
+          channels[c] = src[c];                                                \
+          src[c] += n * stride;                                                \
+        }                                                                      \
+        ebur128_filter_parts(st, &ebur128_format_##format, channels, stride,   \
+                             n, frame_energy);                                 \
+      } else {                                                                 \
+        ebur128_filter_##format(st, src, stride, n, frame_energy);             \
+      }                                                                        \
+      frames -= n;                                                             \
+      if ((st->mode & EBUR128_MODE_LRA) == EBUR128_MODE_LRA) {                 \
+        st->d->short_term_frame_counter += n;                                  \
+      }                                                                        \
+      st->d->needed_frames -= (unsigned long) n;                               \
+      if (st->d->needed_frames == 0 && ebur128_end_subblock(st)) {             \
+        return EBUR128_ERROR_NOMEM;                                            \
+      }                                                                        \
+    }                                                                          \
+    for (c = 0; c < st->channels; c++) {                                       \
+      if (st->d->prev_sample_peak[c] > st->d->sample_peak[c]) {                \
+        st->d->sample_peak[c] = st->d->prev_sample_peak[c];                    \
+      }                                                                        \
+      if (!st->d->true_peak_worker &&                                          \
+          st->d->prev_true_peak[c] > st->d->true_peak[c]) {                    \
+        st->d->true_peak[c] = st->d->prev_true_peak[c];                        \
+      }                                                                        \
+    }                                                                          \
+    ebur128_true_peak_worker_flush(st);                                        \
+    return EBUR128_SUCCESS;                                                    \
+  }
+
+/* Interleaved input with samples of "width" elements of "type". */
+#define EBUR128_ADD_FRAMES_INTERLEAVED(format, type, width)                    \
+  int ebur128_add_frames_##format(ebur128_state* st, const type* src,          \
+                                  size_t frames) {                             \
+    const type* channels[VALIDATE_MAX_CHANNELS];                               \
+    unsigned int c;                                                            \
+    for (c = 0; c < st->channels; c++) {                                       \
+      channels[c] = src + c * (width);                                         \
+    }                                                                          \
+    return ebur128_add_frames_channels_##format(                               \
+        st, channels, st->channels * (width), frames);                         \
   }
-#endif
 
-  VALIDATE_CHANNELS_AND_SAMPLERATE(EBUR128_ERROR_NOMEM);
+#define EBUR128_ADD_FRAMES_PLANAR(type)                                        \
+  int ebur128_add_frames_planar_##type(                                        \
+      ebur128_state* st, const type* const* src, size_t frames) {              \
+    const type* channels[VALIDATE_MAX_CHANNELS];                               \
+    unsigned int c;                                                            \
+    for (c = 0; c < st->channels; c++) {                                       \
+      channels[c] = src[c];                                                    \
+    }                                                                          \
+    return ebur128_add_frames_channels_##type(st, channels, 1, frames);        \
+  }
 
-  if (channels == st->channels && samplerate == st->samplerate) {
-    return EBUR128_ERROR_NO_CHANGE;
+#define EBUR128_ADD_FRAMES_STRIDED(type)                                       \
+  int ebur128_add_frames_strided_##type(ebur128_state* st, const type* src,    \
+                                        size_t stride, size_t frames) {        \
+    const type* channels[VALIDATE_MAX_CHANNELS];                               \
+    unsigned int c;                                                            \
+    for (c = 0; c < st->channels; c++) {                                       \
+      channels[c] = src + c;                                                   \
+    }                                                                          \
+    return ebur128_add_frames_channels_##type(st, channels, stride, frames);   \
   }
 
-  free(st->d->audio_data);
-  st->d->audio_data = NULL;
+#define EBUR128_ADD_FRAMES(type)                                               \
+  EBUR128_ADD_FRAMES_CHANNELS(type, type)                                      \
+  EBUR128_ADD_FRAMES_INTERLEAVED(type, type, 1)                                \
+  EBUR128_ADD_FRAMES_PLANAR(type)                                              \
+  EBUR128_ADD_FRAMES_STRIDED(type)
 
-  if (channels != st->channels) {
-    unsigned int i;
+EBUR128_ADD_FRAMES(short)
+EBUR128_ADD_FRAMES(int)
+EBUR128_ADD_FRAMES(float)
+EBUR128_ADD_FRAMES(double)
 
-    free(st->d->channel_map);
-    st->d->channel_map = NULL;
-    free(st->d->sample_peak);
-    st->d->sample_peak = NULL;
-    free(st->d->prev_sample_peak);
-    st->d->prev_sample_peak = NULL;
-    free(st->d->true_peak);
-    st->d->true_peak = NULL;
-    free(st->d->prev_true_peak);
-    st->d->prev_true_peak = NULL;
-    st->channels = channels;
+#define EBUR128_ADD_FRAMES_PACKED(format, type, width)                         \
+  EBUR128_ADD_FRAMES_CHANNELS(format, type)                                    \
+  EBUR128_ADD_FRAMES_INTERLEAVED(format, type, width)
+
+EBUR128_ADD_FRAMES_PACKED(u8, unsigned char, 1)
+EBUR128_ADD_FRAMES_PACKED(s16be, unsigned char, 2)
+EBUR128_ADD_FRAMES_PACKED(s24le, unsigned char, 3)
+EBUR128_ADD_FRAMES_PACKED(s24be, unsigned char, 3)
+EBUR128_ADD_FRAMES_PACKED(s24in32, int, 1)
+EBUR128_ADD_FRAMES_PACKED(s32be, unsigned char, 4)
+EBUR128_ADD_FRAMES_PACKED(f32be, unsigned char, 4)
+
+/* Streams are filtered in groups that fit into one state, so that the SIMD
+ * kernels run across the channels of several streams. The per-channel data
+ * of all streams is stored in shared arrays, which the states of the streams
+ * and groups point into. */
+struct ebur128_batch {
+  unsigned int streams;
+  unsigned int channels;
+  unsigned int group_streams; /* streams per group */
+  unsigned int groups;
+  ebur128_state** states;
+  ebur128_state** group_states;
+  filter_state* v;
+  double* channel_energy;
+  int* channel_map;
+  double* sample_peak;
+  double* prev_sample_peak;
+  double* true_peak;
+  double* prev_true_peak;
+  /* Peaks of the current block, sample peaks of all lanes followed by true
+   * peaks. The groups write them, the streams copy them at the block end. */
+  double* block_peak;
+  /* Frame energies of one group, interleaved by stream. */
+  double* frame_energy;
+};
 
-    errcode = ebur128_init_channel_map(st);
-    CHECK_ERROR(errcode, EBUR128_ERROR_NOMEM, exit)
+/* Replaces the per-channel buffers of st by those of the batch, starting at
+ * channel "lane". */
+static void ebur128_batch_share(ebur128_batch* batch,
+                                ebur128_state* st,
+                                size_t lane) {
+  free(st->d->v);
+  free(st->d->channel_energy);
+  free(st->d->channel_map);
+  free(st->d->sample_peak);
+  free(st->d->prev_sample_peak);
+  free(st->d->true_peak);
+  free(st->d->prev_true_peak);
+  st->d->v = batch->v + lane;
+  st->d->channel_energy = batch->channel_energy + lane;
+  st->d->channel_map = batch->channel_map + lane;
+  st->d->sample_peak = batch->sample_peak + lane;
+  st->d->prev_sample_peak = batch->prev_sample_peak + lane;
+  st->d->true_peak = batch->true_peak + lane;
+  st->d->prev_true_peak = batch->prev_true_peak + lane;
+}
 
-    st->d->sample_peak = (double*) malloc(channels * sizeof(double));
-    CHECK_ERROR(!st->d->sample_peak, EBUR128_ERROR_NOMEM, exit)
-    st->d->prev_sample_peak = (double*) malloc(channels * sizeof(double));
-    CHECK_ERROR(!st->d->prev_sample_peak, EBUR128_ERROR_NOMEM, exit)
-    st->d->true_peak = (double*) malloc(channels * sizeof(double));
-    CHECK_ERROR(!st->d->true_peak, EBUR128_ERROR_NOMEM, exit)
-    st->d->prev_true_peak = (double*) malloc(channels * sizeof(double));
-    CHECK_ERROR(!st->d->prev_true_peak, EBUR128_ERROR_NOMEM, exit)
-    for (i = 0; i < channels; ++i) {
-      st->d->sample_peak[i] = 0.0;
-      st->d->prev_sample_peak[i] = 0.0;
-      st->d->true_peak[i] = 0.0;
-      st->d->prev_true_peak[i] = 0.0;
-    }
-  }
-  if (samplerate != st->samplerate) {
-    st->samplerate = samplerate;
-    st->d->samples_in_100ms = (st->samplerate + 5) / 10;
+/* Destroys a state whose per-channel buffers belong to the batch. */
+static void ebur128_batch_destroy_state(ebur128_state** st) {
+  if (!*st) {
+    return;
   }
+  (*st)->d->v = NULL;
+  (*st)->d->channel_energy = NULL;
+  (*st)->d->channel_map = NULL;
+  (*st)->d->sample_peak = NULL;
+  (*st)->d->prev_sample_peak = NULL;
+  (*st)->d->true_peak = NULL;
+  (*st)->d->prev_true_peak = NULL;
+  ebur128_destroy(st);
+}
 
-  /* If we're here, either samplerate or channels
-   * have changed. Re-init filter. */
-  free(st->d->v);
-  st->d->v = NULL;
-  errcode = ebur128_init_filter(st);
-  CHECK_ERROR(errcode, EBUR128_ERROR_NOMEM, exit)
+void ebur128_batch_destroy(ebur128_batch** batch) {
+  unsigned int i;
 
-  st->d->audio_data_frames = st->samplerate * st->d->window / 1000;
-  if (st->d->audio_data_frames % st->d->samples_in_100ms) {
-    /* round up to multiple of samples_in_100ms */
-    st->d->audio_data_frames =
-        (st->d->audio_data_frames + st->d->samples_in_100ms) -
-        (st->d->audio_data_frames % st->d->samples_in_100ms);
+  if (!*batch) {
+    return;
   }
-  st->d->audio_data = (double*) malloc(st->d->audio_data_frames * st->channels *
-                                       sizeof(double));
-  CHECK_ERROR(!st->d->audio_data, EBUR128_ERROR_NOMEM, exit)
-  for (j = 0; j < st->d->audio_data_frames * st->channels; ++j) {
-    st->d->audio_data[j] = 0.0;
+  for (i = 0; (*batch)->states && i < (*batch)->streams; ++i) {
+    ebur128_batch_destroy_state(&(*batch)->states[i]);
   }
-
-  ebur128_destroy_resampler(st);
-  errcode = ebur128_init_resampler(st);
-  CHECK_ERROR(errcode, EBUR128_ERROR_NOMEM, exit)
-
-  /* the first block needs 400ms of audio data */
-  st->d->needed_frames = st->d->samples_in_100ms * 4;
-  /* start at the beginning of the buffer */
-  st->d->audio_data_index = 0;
-  /* reset short term frame counter */
-  st->d->short_term_frame_counter = 0;
-
-exit:
-  return errcode;
+  for (i = 0; (*batch)->group_states && i < (*batch)->groups; ++i) {
+    if ((*batch)->group_states[i]) {
+      (*batch)->group_states[i]->d->block_sample_peak = NULL;
+      (*batch)->group_states[i]->d->block_true_peak = NULL;
+    }
+    ebur128_batch_destroy_state(&(*batch)->group_states[i]);
+  }
+  free((*batch)->states);
+  free((*batch)->group_states);
+  free((*batch)->v);
+  free((*batch)->channel_energy);
+  free((*batch)->channel_map);
+  free((*batch)->sample_peak);
+  free((*batch)->prev_sample_peak);
+  free((*batch)->true_peak);
+  free((*batch)->prev_true_peak);
+  free((*batch)->block_peak);
+  free((*batch)->frame_energy);
+  free(*batch);
+  *batch = NULL;
 }
 
-int ebur128_set_max_window(ebur128_state* st, unsigned long window) {
-  int errcode = EBUR128_SUCCESS;
-  size_t j;
+ebur128_batch* ebur128_batch_init(unsigned int streams,
+                                  unsigned int channels,
+                                  unsigned long samplerate,
+                                  int mode) {
+  ebur128_batch* batch;
+  size_t lanes, i;
 
-  if ((st->mode & EBUR128_MODE_S) == EBUR128_MODE_S && window < 3000) {
-    window = 3000;
-  } else if ((st->mode & EBUR128_MODE_M) == EBUR128_MODE_M && window < 400) {
-    window = 400;
+  if (streams == 0 || channels == 0 || channels > VALIDATE_MAX_CHANNELS) {
+    return NULL;
   }
-
-  if (window == st->d->window) {
-    return EBUR128_ERROR_NO_CHANGE;
+  batch = (ebur128_batch*) calloc(1, sizeof(ebur128_batch));
+  if (!batch) {
+    return NULL;
   }
-
-  size_t new_audio_data_frames;
-  if (safe_size_mul(st->samplerate, window, &new_audio_data_frames) != 0 ||
-      new_audio_data_frames > ((size_t) -1) - st->d->samples_in_100ms) {
-    return EBUR128_ERROR_NOMEM;
+  batch->streams = streams;
+  batch->channels = channels;
+  batch->group_streams = VALIDATE_MAX_CHANNELS / channels;
+  if (batch->group_streams > streams) {
+    batch->group_streams = streams;
   }
-  if (new_audio_data_frames % st->d->samples_in_100ms) {
-    /* round up to multiple of samples_in_100ms */
-    new_audio_data_frames = (new_audio_data_frames + st->d->samples_in_100ms) -
-                            (new_audio_data_frames % st->d->samples_in_100ms);
+  batch->groups = (streams + batch->group_streams - 1) / batch->group_streams;
+  lanes = (size_t) streams * channels;
+
+  batch->states = (ebur128_state**) calloc(streams, sizeof(ebur128_state*));
+  batch->group_states =
+      (ebur128_state**) calloc(batch->groups, sizeof(ebur128_state*));
+  batch->v = (filter_state*) calloc(lanes, sizeof(filter_state));
+  batch->channel_energy = (double*) calloc(lanes, sizeof(double));
+  batch->channel_map = (int*) calloc(lanes, sizeof(int));
+  batch->sample_peak = (double*) calloc(lanes, sizeof(double));
+  batch->prev_sample_peak = (double*) calloc(lanes, sizeof(double));
+  batch->true_peak = (double*) calloc(lanes, sizeof(double));
+  batch->prev_true_peak = (double*) calloc(lanes, sizeof(double));
+  batch->block_peak = (double*) calloc(2 * lanes, sizeof(double));
+  if (!batch->states || !batch->group_states || !batch->v ||
+      !batch->channel_energy || !batch->channel_map || !batch->sample_peak ||
+      !batch->prev_sample_peak || !batch->true_peak ||
+      !batch->prev_true_peak || !batch->block_peak) {
+    goto destroy;
   }
 
-  size_t new_audio_data_size;
-  if (safe_size_mul(new_audio_data_frames, st->channels * sizeof(double),
-                    &new_audio_data_size) != 0) {
-    return EBUR128_ERROR_NOMEM;
+  for (i = 0; i < streams; ++i) {
+    batch->states[i] = ebur128_init(channels, samplerate, mode);
+    if (!batch->states[i]) {
+      goto destroy;
+    }
+    memcpy(batch->channel_map + i * channels,
+           batch->states[i]->d->channel_map, channels * sizeof(int));
+    ebur128_batch_share(batch, batch->states[i], i * channels);
   }
-
-  double* new_audio_data = (double*) malloc(new_audio_data_size);
-  CHECK_ERROR(!new_audio_data, EBUR128_ERROR_NOMEM, exit)
-
-  st->d->window = window;
-  free(st->d->audio_data);
-  st->d->audio_data = new_audio_data;
-  st->d->audio_data_frames = new_audio_data_frames;
-  for (j = 0; j < st->d->audio_data_frames * st->channels; ++j) {
-    st->d->audio_data[j] = 0.0;
+  for (i = 0; i < batch->groups; ++i) {
+    unsigned int count = batch->group_streams;
+    ebur128_state* st;
+    if (count > streams - i * batch->group_streams) {
+      count = streams - (unsigned int) i * batch->group_streams;
+    }
+    st = ebur128_init(count * channels, samplerate, mode);
+    if (!st) {
+      goto destroy;
+    }
+    batch->group_states[i] = st;
+    st->d->streams = count;
+    ebur128_batch_share(batch, st, i * batch->group_streams * channels);
+    st->d->block_sample_peak =
+        batch->block_peak + i * batch->group_streams * channels;
+    st->d->block_true_peak = st->d->block_sample_peak + lanes;
   }
+  batch->frame_energy = (double*) malloc(
+      batch->states[0]->d->samples_in_100ms * batch->group_streams *
+      sizeof(double));
+  if (!batch->frame_energy) {
+    goto destroy;
+  }
+  return batch;
 
-  /* the first block needs 400ms of audio data */
-  st->d->needed_frames = st->d->samples_in_100ms * 4;
-  /* start at the beginning of the buffer */
-  st->d->audio_data_index = 0;
-  /* reset short term frame counter */
-  st->d->short_term_frame_counter = 0;
-
-exit:
-  return errcode;
+destroy:
+  ebur128_batch_destroy(&batch);
+  return NULL;
 }
 
-int ebur128_set_max_history(ebur128_state* st, unsigned long history) {
-  if ((st->mode & EBUR128_MODE_LRA) == EBUR128_MODE_LRA && history < 3000) {
-    history = 3000;
-  } else if ((st->mode & EBUR128_MODE_M) == EBUR128_MODE_M && history < 400) {
-    history = 400;
-  }
-  if (history == st->d->history) {
-    return EBUR128_ERROR_NO_CHANGE;
-  }
-  st->d->history = history;
-  st->d->block_list_max = st->d->history / 100;
-  st->d->st_block_list_max = st->d->history / 3000;
-  while (st->d->block_list_size > st->d->block_list_max) {
-    struct ebur128_dq_entry* block = STAILQ_FIRST(&st->d->block_list);
-    STAILQ_REMOVE_HEAD(&st->d->block_list, entries);
-    free(block);
-    st->d->block_list_size--;
-  }
-  while (st->d->st_block_list_size > st->d->st_block_list_max) {
-    struct ebur128_dq_entry* block =
-        STAILQ_FIRST(&st->d->short_term_block_list);
-    STAILQ_REMOVE_HEAD(&st->d->short_term_block_list, entries);
-    free(block);
-    st->d->st_block_list_size--;
+ebur128_state* ebur128_batch_state(ebur128_batch* batch, unsigned int stream) {
+  if (stream >= batch->streams) {
+    return NULL;
   }
-  return EBUR128_SUCCESS;
+  return batch->states[stream];
 }
 
-static int ebur128_energy_shortterm(ebur128_state* st, double* out);
-#define EBUR128_ADD_FRAMES(type)                                               \
-  int ebur128_add_frames_##type(ebur128_state* st, const type* src,            \
-                                size_t frames) {                               \
-    size_t src_index = 0;                                                      \
-    unsigned int c = 0;                                                        \
-    for (c = 0; c < st->channels; c++) {                                       \
-      st->d->prev_sample_peak[c] = 0.0;                                        \
-      st->d->prev_true_peak[c] = 0.0;                                          \
+/* Interleaved input, one buffer per stream. All streams are at the same
+ * position in their 100ms block, so a chunk never crosses a block end. */
+#define EBUR128_BATCH_ADD_FRAMES(type)                                         \
+  int ebur128_batch_add_frames_##type(ebur128_batch* batch,                    \
+                                      const type* const* src, size_t frames) { \
+    const type* channels[VALIDATE_MAX_CHANNELS];                               \
+    size_t lanes = (size_t) batch->streams * batch->channels;                  \
+    size_t offset, n, g, s, c, i;                                              \
+    for (c = 0; c < lanes; c++) {                                              \
+      batch->prev_sample_peak[c] = 0.0;                                        \
+      batch->prev_true_peak[c] = 0.0;                                          \
     }                                                                          \
-    while (frames > 0) {                                                       \
-      if (frames >= st->d->needed_frames) {                                    \
-        ebur128_filter_##type(st, src + src_index, st->d->needed_frames);      \
-        src_index += st->d->needed_frames * st->channels;                      \
-        frames -= st->d->needed_frames;                                        \
-        st->d->audio_data_index += st->d->needed_frames * st->channels;        \
-        /* calculate the new gating block */                                   \
-        if ((st->mode & EBUR128_MODE_I) == EBUR128_MODE_I) {                   \
-          if (ebur128_calc_gating_block(st, st->d->samples_in_100ms * 4,       \
-                                        NULL)) {                               \
-            return EBUR128_ERROR_NOMEM;                                        \
+    for (offset = 0; offset < frames; offset += n) {                           \
+      struct ebur128_state_internal* d = batch->states[0]->d;                  \
+      size_t start = (d->subblock_index + 1) * d->samples_in_100ms -           \
+                     d->needed_frames;                                         \
+      n = EBUR128_MIN(frames - offset, d->needed_frames);                      \
+      for (g = 0; g < batch->groups; ++g) {                                    \
+        ebur128_state* group = batch->group_states[g];                         \
+        size_t first = g * batch->group_streams;                               \
+        size_t count = group->d->streams;                                      \
+        for (s = 0; s < count; ++s) {                                          \
+          for (c = 0; c < batch->channels; ++c) {                              \
+            channels[s * batch->channels + c] =                                \
+                src[first + s] + offset * batch->channels + c;                 \
           }                                                                    \
         }                                                                      \
-        if ((st->mode & EBUR128_MODE_LRA) == EBUR128_MODE_LRA) {               \
-          st->d->short_term_frame_counter += st->d->needed_frames;             \
-          if (st->d->short_term_frame_counter ==                               \
-              st->d->samples_in_100ms * 30) {                                  \
-            struct ebur128_dq_entry* block;                                    \
-            double st_energy;                                                  \
-            if (ebur128_energy_shortterm(st, &st_energy) == EBUR128_SUCCESS && \
-                st_energy >= histogram_energy_boundaries[0]) {                 \
-              if (st->d->use_histogram) {                                      \
-                ++st->d->short_term_block_energy_histogram                     \
-                      [find_histogram_index(st_energy)];                       \
-              } else {                                                         \
-                if (st->d->st_block_list_size == st->d->st_block_list_max) {   \
-                  block = STAILQ_FIRST(&st->d->short_term_block_list);         \
-                  STAILQ_REMOVE_HEAD(&st->d->short_term_block_list, entries);  \
-                } else {                                                       \
-                  block = (struct ebur128_dq_entry*) malloc(                   \
-                      sizeof(struct ebur128_dq_entry));                        \
-                  if (!block) {                                                \
-                    return EBUR128_ERROR_NOMEM;                                \
-                  }                                                            \
-                  st->d->st_block_list_size++;                                 \
-                }                                                              \
-                block->z = st_energy;                                          \
-                STAILQ_INSERT_TAIL(&st->d->short_term_block_list, block,       \
-                                   entries);                                   \
-              }                                                                \
-            }                                                                  \
-            st->d->short_term_frame_counter = st->d->samples_in_100ms * 20;    \
+        ebur128_filter_##type(group, channels, batch->channels, n,             \
+                              batch->frame_energy);                            \
+        for (s = 0; s < count; ++s) {                                          \
+          double* frame_energy = batch->states[first + s]->d->frame_energy;    \
+          for (i = 0; i < n; ++i) {                                            \
+            frame_energy[start + i] = batch->frame_energy[i * count + s];      \
           }                                                                    \
         }                                                                      \
-        /* 100ms are needed for all blocks besides the first one */            \
-        st->d->needed_frames = st->d->samples_in_100ms;                        \
-        /* reset audio_data_index when buffer full */                          \
-        if (st->d->audio_data_index ==                                         \
-            st->d->audio_data_frames * st->channels) {                         \
-          st->d->audio_data_index = 0;                                         \
-        }                                                                      \
-      } else {                                                                 \
-        ebur128_filter_##type(st, src + src_index, frames);                    \
-        st->d->audio_data_index += frames * st->channels;                      \
+      }                                                                        \
+      for (s = 0; s < batch->streams; ++s) {                                   \
+        ebur128_state* st = batch->states[s];                                  \
+        double* block_peak = batch->block_peak + s * batch->channels;          \
         if ((st->mode & EBUR128_MODE_LRA) == EBUR128_MODE_LRA) {               \
-          st->d->short_term_frame_counter += frames;                           \
+          st->d->short_term_frame_counter += n;                                \
+        }                                                                      \
+        st->d->needed_frames -= (unsigned long) n;                             \
+        if (st->d->needed_frames > 0) {                                        \
+          continue;                                                            \
+        }                                                                      \
+        for (c = 0; c < batch->channels; ++c) {                                \
+          if (st->d->block_sample_peak) {                                      \
+            st->d->block_sample_peak[c] = block_peak[c];                       \
+            st->d->block_true_peak[c] = block_peak[lanes + c];                 \
+          }                                                                    \
+          block_peak[c] = 0.0;                                                 \
+          block_peak[lanes + c] = 0.0;                                         \
+        }                                                                      \
+        if (ebur128_end_subblock(st)) {                                        \
+          return EBUR128_ERROR_NOMEM;                                          \
         }                                                                      \
-        st->d->needed_frames -= (unsigned long) frames;                        \
-        frames = 0;                                                            \
       }                                                                        \
     }                                                                          \
-    for (c = 0; c < st->channels; c++) {                                       \
-      if (st->d->prev_sample_peak[c] > st->d->sample_peak[c]) {                \
-        st->d->sample_peak[c] = st->d->prev_sample_peak[c];                    \
+    for (c = 0; c < lanes; c++) {                                              \
+      if (batch->prev_sample_peak[c] > batch->sample_peak[c]) {                \
+        batch->sample_peak[c] = batch->prev_sample_peak[c];                    \
       }                                                                        \
-      if (st->d->prev_true_peak[c] > st->d->true_peak[c]) {                    \
-        st->d->true_peak[c] = st->d->prev_true_peak[c];                        \
+      if (batch->prev_true_peak[c] > batch->true_peak[c]) {                    \
+        batch->true_peak[c] = batch->prev_true_peak[c];                        \
       }                                                                        \
     }                                                                          \
     return EBUR128_SUCCESS;                                                    \
   }
 
-EBUR128_ADD_FRAMES(short)
-EBUR128_ADD_FRAMES(int)
-EBUR128_ADD_FRAMES(float)
-EBUR128_ADD_FRAMES(double)
+EBUR128_BATCH_ADD_FRAMES(short)
+EBUR128_BATCH_ADD_FRAMES(int)
+EBUR128_BATCH_ADD_FRAMES(float)
+EBUR128_BATCH_ADD_FRAMES(double)
 
 static int ebur128_calc_relative_threshold(ebur128_state* st,
                                            size_t* above_thresh_counter,
                                            double* relative_threshold) {
-  struct ebur128_dq_entry* it;
-  size_t i;
+  struct ebur128_double_list* list = &st->d->block_list;
+  size_t i, j;
 
   if (st->d->use_histogram) {
     for (i = 0; i < 1000; ++i) {
@@ -1072,11 +4423,19 @@ static int ebur128_calc_relative_threshold(ebur128_state* st,
           st->d->block_energy_histogram[i] * histogram_energies[i];
       *above_thresh_counter += st->d->block_energy_histogram[i];
     }
+  } else if (list->sorted) {
+    if (list->tree.root) {
+      *relative_threshold += list->tree.nodes[list->tree.root].sum;
+      *above_thresh_counter += list->tree.nodes[list->tree.root].count;
+    }
   } else {
-    STAILQ_FOREACH(it, &st->d->block_list, entries) {
-      ++*above_thresh_counter;
-      *relative_threshold += it->z;
+    for (i = 0, j = list->start; i < list->size; ++i) {
+      *relative_threshold += list->z[j];
+      if (++j == list->capacity) {
+        j = 0;
+      }
     }
+    *above_thresh_counter += list->size;
   }
 
   return EBUR128_SUCCESS;
@@ -1084,11 +4443,10 @@ static int ebur128_calc_relative_threshold(ebur128_state* st,
 
 static int
 ebur128_gated_loudness(ebur128_state** sts, size_t size, double* out) {
-  struct ebur128_dq_entry* it;
   double gated_loudness = 0.0;
   double relative_threshold = 0.0;
   size_t above_thresh_counter = 0;
-  size_t i, j, start_index;
+  size_t i, j, k, start_index;
 
   for (i = 0; i < size; i++) {
     if (sts[i] && (sts[i]->mode & EBUR128_MODE_I) != EBUR128_MODE_I) {
@@ -1130,11 +4488,18 @@ ebur128_gated_loudness(ebur128_state** sts, size_t size, double* out) {
             sts[i]->d->block_energy_histogram[j] * histogram_energies[j];
         above_thresh_counter += sts[i]->d->block_energy_histogram[j];
       }
+    } else if (sts[i]->d->block_list.sorted) {
+      ebur128_tree_sum_above(&sts[i]->d->block_list.tree, relative_threshold,
+                             &gated_loudness, &above_thresh_counter);
     } else {
-      STAILQ_FOREACH(it, &sts[i]->d->block_list, entries) {
-        if (it->z >= relative_threshold) {
+      struct ebur128_double_list* list = &sts[i]->d->block_list;
+      for (k = 0, j = list->start; k < list->size; ++k) {
+        if (list->z[j] >= relative_threshold) {
           ++above_thresh_counter;
-          gated_loudness += it->z;
+          gated_loudness += list->z[j];
+        }
+        if (++j == list->capacity) {
+          j = 0;
         }
       }
     }
@@ -1184,10 +4549,42 @@ int ebur128_loudness_global_multiple(ebur128_state** sts,
 static int ebur128_energy_in_interval(ebur128_state* st,
                                       size_t interval_frames,
                                       double* out) {
-  if (interval_frames > st->d->audio_data_frames) {
+  size_t samples_in_100ms = st->d->samples_in_100ms;
+  /* frames of the current, incomplete 100ms block */
+  size_t done = samples_in_100ms - st->d->needed_frames;
+  size_t end = st->d->subblock_index * samples_in_100ms + done;
+  size_t remaining, i, j, c;
+  double sum = 0.0;
+
+  if (interval_frames > st->d->subblocks * samples_in_100ms) {
     return EBUR128_ERROR_INVALID_MODE;
   }
-  ebur128_calc_gating_block(st, interval_frames, out);
+  if (interval_frames <= done) {
+    for (i = end - interval_frames; i < end; ++i) {
+      sum += st->d->frame_energy[i];
+    }
+  } else {
+    for (c = 0; c < st->channels; ++c) {
+      sum += st->d->channel_energy[c];
+    }
+    remaining = interval_frames - done;
+    j = st->d->subblock_index;
+    while (remaining > 0) {
+      j = (j == 0 ? st->d->subblocks : j) - 1;
+      if (remaining >= samples_in_100ms) {
+        sum += st->d->subblock_energy[j];
+        remaining -= samples_in_100ms;
+      } else {
+        /* the interval starts inside of this block */
+        end = (j + 1) * samples_in_100ms;
+        for (i = end - remaining; i < end; ++i) {
+          sum += st->d->frame_energy[i];
+        }
+        remaining = 0;
+      }
+    }
+  }
+  *out = sum / (double) interval_frames;
   return EBUR128_SUCCESS;
 }
 
@@ -1239,13 +4636,19 @@ int ebur128_loudness_window(ebur128_state* st,
   int error;
 
   if (window > st->d->window) {
-    return EBUR128_ERROR_INVALID_MODE;
-  }
-
-  interval_frames = st->samplerate * window / 1000;
-  error = ebur128_energy_in_interval(st, interval_frames, &energy);
-  if (error) {
-    return error;
+    /* whole blocks, up to the last completed one */
+    if (!st->d->long_window || window % 100 != 0 ||
+        window / 100 >= st->d->long_window->size) {
+      return EBUR128_ERROR_INVALID_MODE;
+    }
+    energy = ebur128_long_window_sum(st->d->long_window, window / 100) /
+             (double) (window / 100 * st->d->samples_in_100ms);
+  } else {
+    interval_frames = st->samplerate * window / 1000;
+    error = ebur128_energy_in_interval(st, interval_frames, &energy);
+    if (error) {
+      return error;
+    }
   }
 
   if (energy <= 0.0) {
@@ -1263,12 +4666,44 @@ static int ebur128_double_cmp(const void* p1, const void* p2) {
   return (*d1 > *d2) - (*d1 < *d2);
 }
 
+/* EBU - TECH 3342, with the short term block energies taken from a tree
+ * instead of a sorted copy of the list. */
+static void ebur128_loudness_range_sorted(struct ebur128_tree* tree,
+                                          double* out) {
+  size_t stl_size, stl_relgated_size = 0;
+  double stl_power, stl_integrated, stl_relgated_power = 0.0;
+  /* High and low percentile energy */
+  double h_en, l_en;
+
+  if (!tree->root) {
+    *out = 0.0;
+    return;
+  }
+  stl_size = tree->nodes[tree->root].count;
+  stl_power = tree->nodes[tree->root].sum / (double) stl_size;
+  stl_integrated = minus_twenty_decibels * stl_power;
+
+  ebur128_tree_sum_above(tree, stl_integrated, &stl_relgated_power,
+                         &stl_relgated_size);
+  if (!stl_relgated_size) {
+    *out = 0.0;
+    return;
+  }
+  /* skip the blocks below the relative gate */
+  stl_size -= stl_relgated_size;
+  h_en = ebur128_tree_select(
+      tree, stl_size + (size_t) ((stl_relgated_size - 1) * 0.95 + 0.5));
+  l_en = ebur128_tree_select(
+      tree, stl_size + (size_t) ((stl_relgated_size - 1) * 0.1 + 0.5));
+  *out = ebur128_energy_to_loudness(h_en) - ebur128_energy_to_loudness(l_en);
+}
+
 /* EBU - TECH 3342 */
 int ebur128_loudness_range_multiple(ebur128_state** sts,
                                     size_t size,
                                     double* out) {
-  size_t i, j;
-  struct ebur128_dq_entry* it;
+  size_t i, j, k, l;
+  struct ebur128_double_list* list;
   double* stl_vector;
   size_t stl_size;
   double* stl_relgated;
@@ -1352,14 +4787,17 @@ int ebur128_loudness_range_multiple(ebur128_state** sts,
     return EBUR128_SUCCESS;
   }
 
+  if (size == 1 && sts[0] && sts[0]->d->short_term_block_list.sorted) {
+    ebur128_loudness_range_sorted(&sts[0]->d->short_term_block_list.tree, out);
+    return EBUR128_SUCCESS;
+  }
+
   stl_size = 0;
   for (i = 0; i < size; ++i) {
     if (!sts[i]) {
       continue;
     }
-    STAILQ_FOREACH(it, &sts[i]->d->short_term_block_list, entries) {
-      ++stl_size;
-    }
+    stl_size += sts[i]->d->short_term_block_list.size;
   }
   if (!stl_size) {
     *out = 0.0;
@@ -1375,9 +4813,12 @@ int ebur128_loudness_range_multiple(ebur128_state** sts,
     if (!sts[i]) {
       continue;
     }
-    STAILQ_FOREACH(it, &sts[i]->d->short_term_block_list, entries) {
-      stl_vector[j] = it->z;
-      ++j;
+    list = &sts[i]->d->short_term_block_list;
+    for (k = 0, l = list->start; k < list->size; ++k) {
+      stl_vector[j++] = list->z[l];
+      if (++l == list->capacity) {
+        l = 0;
+      }
     }
   }
   qsort(stl_vector, stl_size, sizeof(double), ebur128_double_cmp);
@@ -1453,6 +4894,7 @@ int ebur128_true_peak(ebur128_state* st,
     return EBUR128_ERROR_INVALID_CHANNEL_INDEX;
   }
 
+  ebur128_true_peak_worker_sync(st);
   *out = EBUR128_MAX(st->d->true_peak[channel_number],
                      st->d->sample_peak[channel_number]);
   return EBUR128_SUCCESS;
@@ -1469,7 +4911,201 @@ int ebur128_prev_true_peak(ebur128_state* st,
     return EBUR128_ERROR_INVALID_CHANNEL_INDEX;
   }
 
+  ebur128_true_peak_worker_sync(st);
   *out = EBUR128_MAX(st->d->prev_true_peak[channel_number],
                      st->d->prev_sample_peak[channel_number]);
   return EBUR128_SUCCESS;
 }
+
+/* Turns EBUR128_MODE_INCREMENTAL on or off for a state that has already
+ * measured blocks. */
+static int ebur128_set_incremental(ebur128_state* st, int enable) {
+  if (ebur128_list_set_sorted(&st->d->block_list, enable) ||
+      ebur128_list_set_sorted(&st->d->short_term_block_list, enable)) {
+    ebur128_list_set_sorted(&st->d->block_list, 0);
+    return EBUR128_ERROR_NOMEM;
+  }
+  if (enable) {
+    st->mode |= EBUR128_MODE_INCREMENTAL;
+  } else {
+    st->mode &= ~EBUR128_MODE_INCREMENTAL;
+  }
+  return EBUR128_SUCCESS;
+}
+
+struct ebur128_offload {
+  ebur128_state* st;
+  ebur128_thread thread;
+  /* Interleaved frames, one of which is always unused. */
+  float* ring;
+  ebur128_atomic size;
+  /* Next frame to analyse, only written by the analysis thread. */
+  ebur128_atomic head;
+  /* Next frame to write, only written by the audio thread. */
+  ebur128_atomic tail;
+  ebur128_atomic overruns;
+  ebur128_atomic errcode;
+  ebur128_atomic quit;
+  /* Posted for new frames while the analysis thread waits, and on quit. */
+  ebur128_sem wake;
+  ebur128_atomic waiting;
+  /* The snapshot of the state was turned on by the offload. */
+  int own_snapshot;
+  /* So was EBUR128_MODE_INCREMENTAL, for the integrated loudness. */
+  int own_incremental;
+};
+
+EBUR128_THREAD_FUNC(ebur128_offload_main, arg) {
+  ebur128_offload* offload = (ebur128_offload*) arg;
+  ebur128_state* st = offload->st;
+  ebur128_atomic head = 0;
+
+  for (;;) {
+    /* quit is read first, so that no frames written before it are missed */
+    ebur128_atomic quit = ebur128_atomic_load(&offload->quit);
+    ebur128_atomic tail = ebur128_atomic_load(&offload->tail);
+    ebur128_atomic n;
+    int errcode;
+
+    if (head == tail) {
+      if (quit) {
+        break;
+      }
+      /* frames written after the flag is set are followed by a post, the
+       * ones before it are seen by the second look at tail */
+      ebur128_atomic_store(&offload->waiting, 1);
+      if (ebur128_atomic_load(&offload->tail) == head &&
+          !ebur128_atomic_load(&offload->quit)) {
+        ebur128_sem_wait(&offload->wake);
+      }
+      ebur128_atomic_store(&offload->waiting, 0);
+      continue;
+    }
+    n = (tail > head ? tail : offload->size) - head;
+    errcode = ebur128_add_frames_float(
+        st, offload->ring + (size_t) head * st->channels, (size_t) n);
+    if (errcode && !ebur128_atomic_load(&offload->errcode)) {
+      ebur128_atomic_store(&offload->errcode, errcode);
+    }
+    head = (head + n) % offload->size;
+    ebur128_atomic_store(&offload->head, head);
+  }
+  EBUR128_THREAD_RETURN;
+}
+
+ebur128_offload* ebur128_offload_create(ebur128_state* st, size_t frames) {
+  ebur128_offload* offload;
+
+  if (frames == 0 || frames >= (size_t) LONG_MAX / st->channels) {
+    return NULL;
+  }
+  offload = (ebur128_offload*) calloc(1, sizeof(ebur128_offload));
+  if (!offload) {
+    goto exit;
+  }
+  offload->ring =
+      (float*) malloc((frames + 1) * st->channels * sizeof(float));
+  if (!offload->ring) {
+    goto free_offload;
+  }
+  offload->st = st;
+  offload->size = (ebur128_atomic) (frames + 1);
+  if (!st->d->snapshot) {
+    if (ebur128_set_snapshot(st, 1)) {
+      goto free_ring;
+    }
+    offload->own_snapshot = 1;
+  }
+  if (offload->own_snapshot && !st->d->use_histogram &&
+      !(st->mode & EBUR128_MODE_INCREMENTAL)) {
+    if (ebur128_set_incremental(st, 1)) {
+      goto free_snapshot;
+    }
+    offload->own_incremental = 1;
+  }
+  if (ebur128_sem_init(&offload->wake)) {
+    goto free_incremental;
+  }
+  if (ebur128_thread_start(&offload->thread, ebur128_offload_main, offload)) {
+    goto free_wake;
+  }
+  return offload;
+
+free_wake:
+  ebur128_sem_destroy(&offload->wake);
+free_incremental:
+  if (offload->own_incremental) {
+    ebur128_set_incremental(st, 0);
+  }
+free_snapshot:
+  if (offload->own_snapshot) {
+    ebur128_set_snapshot(st, 0);
+  }
+free_ring:
+  free(offload->ring);
+free_offload:
+  free(offload);
+exit:
+  return NULL;
+}
+
+void ebur128_offload_destroy(ebur128_offload** offload) {
+  if (!*offload) {
+    return;
+  }
+  ebur128_atomic_store(&(*offload)->quit, 1);
+  ebur128_sem_post(&(*offload)->wake);
+  ebur128_thread_join((*offload)->thread);
+  ebur128_sem_destroy(&(*offload)->wake);
+  if ((*offload)->own_incremental) {
+    ebur128_set_incremental((*offload)->st, 0);
+  }
+  if ((*offload)->own_snapshot) {
+    ebur128_set_snapshot((*offload)->st, 0);
+  }
+  free((*offload)->ring);
+  free(*offload);
+  *offload = NULL;
+}
+
+int ebur128_offload_add_frames_float(ebur128_offload* offload,
+                                     const float* src,
+                                     size_t frames) {
+  size_t channels = offload->st->channels;
+  ebur128_atomic size = offload->size;
+  ebur128_atomic tail = offload->tail;
+  ebur128_atomic space =
+      (ebur128_atomic_load(&offload->head) - tail - 1 + size) % size;
+  size_t n = EBUR128_MIN(frames, (size_t) space);
+  size_t first = EBUR128_MIN(n, (size_t) (size - tail));
+
+  memcpy(offload->ring + (size_t) tail * channels, src,
+         first * channels * sizeof(float));
+  memcpy(offload->ring, src + first * channels,
+         (n - first) * channels * sizeof(float));
+  ebur128_atomic_store(&offload->tail,
+                       (ebur128_atomic) (((size_t) tail + n) % (size_t) size));
+  if (n > 0 && ebur128_atomic_load(&offload->waiting)) {
+    ebur128_sem_post(&offload->wake);
+  }
+  if (n < frames) {
+    ebur128_atomic_store(
+        &offload->overruns,
+        (ebur128_atomic) (((unsigned long) offload->overruns + (frames - n)) &
+                          LONG_MAX));
+  }
+  return EBUR128_SUCCESS;
+}
+
+unsigned long ebur128_offload_overruns(ebur128_offload* offload) {
+  return (unsigned long) ebur128_atomic_load(&offload->overruns);
+}
+
+int ebur128_offload_snapshot(ebur128_offload* offload, ebur128_snapshot* out) {
+  int errcode = ebur128_get_snapshot(offload->st, out);
+
+  if (errcode) {
+    return errcode;
+  }
+  return (int) ebur128_atomic_load(&offload->errcode);
+}
@@ -73,6 +73,17 @@ enum error {
   EBUR128_ERROR_NO_CHANGE
 };
 
+/** \enum simd_level
+ *  Instruction sets used by the processing kernels, see
+ *  ebur128_get_simd_level.
+ */
+enum simd_level {
+  EBUR128_SIMD_NONE = 0, /**< portable C */
+  EBUR128_SIMD_SSE2,     /**< SSE2 */
+  EBUR128_SIMD_AVX2,     /**< AVX2 */
+  EBUR128_SIMD_AVX512    /**< AVX-512F */
+};
+
 /** \enum mode
  *  Use these values in ebur128_init (or'ed). Try to use the lowest possible
  *  modes that suit your needs, as performance will be better.
@@ -91,7 +102,15 @@ enum mode {
   /** can call ebur128_true_peak */
   EBUR128_MODE_TRUE_PEAK = (1 << 5) | EBUR128_MODE_M | EBUR128_MODE_SAMPLE_PEAK,
   /** uses histogram algorithm to calculate loudness */
-  EBUR128_MODE_HISTOGRAM = (1 << 6)
+  EBUR128_MODE_HISTOGRAM = (1 << 6),
+  /** keeps block energies sorted, so that ebur128_loudness_global,
+   *  ebur128_relative_threshold and ebur128_loudness_range don't have to
+   *  look at every block. Use this if you call them often during long
+   *  measurements. Has no effect together with EBUR128_MODE_HISTOGRAM. */
+  EBUR128_MODE_INCREMENTAL = (1 << 7),
+  /** like EBUR128_MODE_TRUE_PEAK, but skips oversampling of audio that can't
+   *  raise the true peak. See \ref ebur128_prev_true_peak */
+  EBUR128_MODE_TRUE_PEAK_SKIP = (1 << 8) | EBUR128_MODE_TRUE_PEAK
 };
 
 /** forward declaration of ebur128_state_internal */
@@ -116,6 +135,20 @@ typedef struct {
  */
 void ebur128_get_version(int* major, int* minor, int* patch);
 
+/** \brief Get the instruction set used by the processing kernels.
+ *
+ *  The widest instruction set supported by the CPU is chosen once, when the
+ *  first state is created. The environment variable EBUR128_SIMD can lower
+ *  it to "none", "sse2", "avx2" or "avx512", e.g. for benchmarking. All
+ *  levels give identical results, since no multiply and add is contracted to
+ *  an FMA instruction. The filter and the true peak interpolator have a
+ *  kernel for each level. Sample conversion, peak search and energy sums are
+ *  left to the compiler's vectorizer.
+ *
+ *  @return one of the values of the simd_level enum.
+ */
+int ebur128_get_simd_level(void);
+
 /** \brief Initialize library state.
  *
  *  @param channels the number of channels.
@@ -142,6 +175,12 @@ void ebur128_destroy(ebur128_state** st);
  *  - 4 -> EBUR128_LEFT_SURROUND
  *  - 5 -> EBUR128_RIGHT_SURROUND
  *
+ *  The channel weight is applied when frames are filtered, so a change only
+ *  applies to the frames that are added after it. Energies of frames that
+ *  were added before keep their old weight, also in the momentary and short
+ *  term windows that include them. Unused channels are not filtered, and
+ *  start from their last filter state when they are used again.
+ *
  *  @param st library state.
  *  @param channel_number zero based channel index.
  *  @param value channel type from the "channel" enum.
@@ -186,6 +225,27 @@ int ebur128_change_parameters(ebur128_state* st,
  */
 int ebur128_set_max_window(ebur128_state* st, unsigned long window);
 
+/** \brief Set the maximum duration of long windows.
+ *
+ *  The maximum window of ebur128_set_max_window keeps the energy of every
+ *  frame, which needs a lot of memory for windows of minutes or hours. Long
+ *  windows only keep the energy of each 100ms block, and their loudness is
+ *  calculated in O(log n) time for windows of n blocks, without losing
+ *  precision after loud passages. ebur128_loudness_window uses them for
+ *  windows that are longer than the maximum window.
+ *
+ *  Only blocks that are completed after this call are part of long windows.
+ *
+ *  @param st library state.
+ *  @param window duration of the longest window in ms, rounded up to a
+ *         multiple of 100ms. Zero stops keeping the blocks.
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_NOMEM on memory allocation error.
+ *    - EBUR128_ERROR_NO_CHANGE if window duration not changed.
+ */
+int ebur128_set_max_long_window(ebur128_state* st, unsigned long window);
+
 /** \brief Set the maximum history.
  *
  *  Set the maximum history that will be stored for loudness integration.
@@ -205,6 +265,209 @@ int ebur128_set_max_window(ebur128_state* st, unsigned long window);
  */
 int ebur128_set_max_history(ebur128_state* st, unsigned long history);
 
+/** \brief Set the number of threads used to filter the input.
+ *
+ *  With more than one thread, long inputs are split in time into segments of
+ *  complete 100ms blocks, which are filtered in parallel, each from silence.
+ *  The filter forgets its start state within a few blocks, which are then
+ *  filtered again from the end of the previous segment. Peaks are identical
+ *  to the single threaded ones. Loudness values differ by rounding only,
+ *  which stays well below 1e-6 LU, as the filter state can't be carried over
+ *  to the last bit. Short inputs, and the rest of each input that does not
+ *  fill all threads, are processed by the calling thread.
+ *
+ *  Default is 1, i.e. the calling thread only. Maximum is 64.
+ *
+ *  @param st library state.
+ *  @param threads number of threads, including the calling thread.
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_NOMEM if the threads could not be started. The state
+ *      then uses the calling thread only.
+ *    - EBUR128_ERROR_NO_CHANGE if the number of threads is not changed.
+ */
+int ebur128_set_threads(ebur128_state* st, unsigned int threads);
+
+/** \brief A function that ebur128_task_runner calls for each index. */
+typedef void (*ebur128_task)(void* arg, unsigned int index);
+
+/** \brief Runs task(arg, i) for each i in [0, count), possibly in parallel,
+ *  and returns when all of them are done. "user" is passed through from
+ *  ebur128_set_channel_parts.
+ */
+typedef void (*ebur128_task_runner)(void* user,
+                                    ebur128_task task,
+                                    void* arg,
+                                    unsigned int count);
+
+/** \brief Filter groups of channels in parallel.
+ *
+ *  For states with many channels. The channels are split into "parts"
+ *  groups of adjacent channels, or one per channel if there are fewer, which
+ *  are filtered, and checked for peaks, by one task each. Groups hold a
+ *  multiple of 8 channels if that gives the same number of groups, and
+ *  nearly equal numbers of channels otherwise. The energies of the channels
+ *  are summed in channel order afterwards, so the results are identical to
+ *  those of a single task.
+ *  The tasks run on "run", or, if it is NULL, on the threads of
+ *  ebur128_set_threads or the calling thread. The input is not split in
+ *  time by ebur128_set_threads while channel parts are used.
+ *
+ *  @param st library state.
+ *  @param parts number of groups. 0 or 1 turns off the splitting.
+ *  @param run function that runs the tasks, or NULL.
+ *  @param user passed to run.
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_NOMEM on memory allocation error.
+ */
+int ebur128_set_channel_parts(ebur128_state* st,
+                              unsigned int parts,
+                              ebur128_task_runner run,
+                              void* user);
+
+/** \brief Interpolate the true peak on a separate thread.
+ *
+ *  With EBUR128_MODE_TRUE_PEAK, the oversampling takes longer than the
+ *  loudness filter. When enabled, ebur128_add_frames_* converts the input
+ *  and queues it for a worker thread, which interpolates it while the
+ *  calling thread goes on with the loudness. ebur128_true_peak and
+ *  ebur128_prev_true_peak wait for the queued input first, so the results
+ *  are the same as without the worker. Calls that use ebur128_set_threads,
+ *  ebur128_set_channel_parts or ebur128_start_chunk wait for the worker
+ *  before they start.
+ *
+ *  @param st library state.
+ *  @param enable non-zero to start the worker, zero to stop it.
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_INVALID_MODE if the mode has no true peak.
+ *    - EBUR128_ERROR_NOMEM if the thread could not be started.
+ *    - EBUR128_ERROR_NO_CHANGE if the worker is already in that state.
+ */
+int ebur128_set_true_peak_worker(ebur128_state* st, int enable);
+
+/** \brief Make a state measure a chunk of a longer stream.
+ *
+ *  A long stream can be measured in parallel by splitting it into chunks,
+ *  measuring each chunk with its own state, and combining the states with
+ *  ebur128_merge. All states need the same channels, samplerate, mode and
+ *  maximum window. Chunks have to start on a 100ms block of the stream, i.e.
+ *  at a multiple of (samplerate + 5) / 10 frames.
+ *
+ *  For every chunk but the first, call this function on a new state and
+ *  then add the "preroll" frames just before the chunk, followed by the
+ *  chunk itself. The preroll frames only set up the filter and the true peak
+ *  interpolator, so that the chunk is measured as in one pass over the whole
+ *  stream. One second of preroll is plenty: the filter forgets its previous
+ *  state to far below double precision within it.
+ *
+ *  @param st library state. No frames must have been added yet.
+ *  @param first_block position of the chunk in the stream, in 100ms blocks.
+ *  @param preroll number of frames before the chunk that will be added
+ *                 first. Can be smaller than one second at the start of the
+ *                 stream.
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_INVALID_MODE if frames have been added already.
+ */
+int ebur128_start_chunk(ebur128_state* st,
+                        unsigned long first_block,
+                        size_t preroll);
+
+/** \brief Append the measurement of the following chunk to a state.
+ *
+ *  Afterwards, dst holds the results of dst's and src's chunks as if they
+ *  had been measured in one pass, see ebur128_start_chunk: gating and short
+ *  term blocks that span both chunks are calculated from the first blocks
+ *  of src, peaks are the maxima of both. dst can continue with the frames
+ *  that follow src's chunk. src is not changed.
+ *
+ *  The long windows of ebur128_set_max_long_window and the points of
+ *  ebur128_set_timeline are merged as well. The points whose windows span
+ *  both chunks are calculated again. Either both states or neither need a
+ *  timeline, with the same hop, and the same maximum long window.
+ *
+ *  @param dst state of the earlier chunk. Its chunk must end on a 100ms
+ *             block, where the chunk of src starts.
+ *  @param src state of the later chunk.
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_NOMEM on memory allocation error.
+ *    - EBUR128_ERROR_INVALID_MODE if the states do not have the same
+ *      parameters, timeline hop or long window, or the chunks do not follow
+ *      each other.
+ */
+int ebur128_merge(ebur128_state* dst, const ebur128_state* src);
+
+/** \brief Many streams with the same parameters that are processed together.
+ *
+ *  Adding frames to all streams with one call saves the per-call overhead of
+ *  each stream, and the filter runs across the channels of several streams
+ *  in parallel. The filter states, channel maps and peaks of all streams are
+ *  kept in shared arrays.
+ */
+typedef struct ebur128_batch ebur128_batch;
+
+/** \brief Initialize a batch of streams.
+ *
+ *  @param streams the number of streams.
+ *  @param channels the number of channels of each stream.
+ *  @param samplerate the sample rate.
+ *  @param mode see the mode enum for possible values.
+ *  @return an initialized batch, or NULL on errors.
+ */
+ebur128_batch* ebur128_batch_init(unsigned int streams,
+                                  unsigned int channels,
+                                  unsigned long samplerate,
+                                  int mode);
+
+/** \brief Destroy a batch and the states of its streams.
+ *  @param batch pointer to a batch, which will be set to NULL.
+ */
+void ebur128_batch_destroy(ebur128_batch** batch);
+
+/** \brief Get the state of one stream of a batch.
+ *
+ *  The state can be passed to ebur128_set_channel, ebur128_set_max_history,
+ *  ebur128_set_block_callback, ebur128_set_snapshot, ebur128_set_shared,
+ *  ebur128_set_timeline and to all functions that get loudness or peak
+ *  values. The blocks and snapshots have the peaks of the stream. The state
+ *  must not be used otherwise: frames are only added through the batch, and
+ *  the state is destroyed with it.
+ *
+ *  @param batch the batch.
+ *  @param stream index of the stream.
+ *  @return the state of the stream, or NULL if the index is invalid.
+ */
+ebur128_state* ebur128_batch_state(ebur128_batch* batch, unsigned int stream);
+
+/** \brief Add frames to all streams of a batch.
+ *
+ *  @param batch the batch.
+ *  @param src one array of source frames per stream, with interleaved
+ *             channels. All of them hold "frames" frames.
+ *  @param frames number of frames. Not number of samples!
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_NOMEM on memory allocation error.
+ */
+int ebur128_batch_add_frames_short(ebur128_batch* batch,
+                                   const short* const* src,
+                                   size_t frames);
+/** \brief See \ref ebur128_batch_add_frames_short */
+int ebur128_batch_add_frames_int(ebur128_batch* batch,
+                                 const int* const* src,
+                                 size_t frames);
+/** \brief See \ref ebur128_batch_add_frames_short */
+int ebur128_batch_add_frames_float(ebur128_batch* batch,
+                                   const float* const* src,
+                                   size_t frames);
+/** \brief See \ref ebur128_batch_add_frames_short */
+int ebur128_batch_add_frames_double(ebur128_batch* batch,
+                                    const double* const* src,
+                                    size_t frames);
+
 /** \brief Add frames to be processed.
  *
  *  @param st library state.
@@ -228,6 +491,125 @@ int ebur128_add_frames_double(ebur128_state* st,
                               const double* src,
                               size_t frames);
 
+/** \brief Add frames with one buffer per channel.
+ *
+ *  Same as \ref ebur128_add_frames_short, but for planar input, as delivered
+ *  by many decoders and plugin hosts. This avoids interleaving the audio
+ *  first.
+ *
+ *  @param st library state.
+ *  @param src array of st->channels pointers, each to "frames" samples of one
+ *             channel.
+ *  @param frames number of frames. Not number of samples!
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_NOMEM on memory allocation error.
+ */
+int ebur128_add_frames_planar_short(ebur128_state* st,
+                                    const short* const* src,
+                                    size_t frames);
+/** \brief See \ref ebur128_add_frames_planar_short */
+int ebur128_add_frames_planar_int(ebur128_state* st,
+                                  const int* const* src,
+                                  size_t frames);
+/** \brief See \ref ebur128_add_frames_planar_short */
+int ebur128_add_frames_planar_float(ebur128_state* st,
+                                    const float* const* src,
+                                    size_t frames);
+/** \brief See \ref ebur128_add_frames_planar_short */
+int ebur128_add_frames_planar_double(ebur128_state* st,
+                                     const double* const* src,
+                                     size_t frames);
+
+/** \brief Add frames from a subset of the channels of a wider buffer.
+ *
+ *  Same as \ref ebur128_add_frames_short, but consecutive frames are
+ *  "stride" samples apart. This lets several states measure different
+ *  programs carried in one interleaved buffer without copying them out. For
+ *  example, the stereo program on channels 6 and 7 of a 64 channel buffer is
+ *  added with:
+ *
+ *      ebur128_add_frames_strided_float(st, buffer + 6, 64, frames);
+ *
+ *  @param st library state.
+ *  @param src pointer to the first sample of the first channel of st.
+ *  @param stride number of samples from one frame to the next. Must be at
+ *                least st->channels.
+ *  @param frames number of frames. Not number of samples!
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_NOMEM on memory allocation error.
+ */
+int ebur128_add_frames_strided_short(ebur128_state* st,
+                                     const short* src,
+                                     size_t stride,
+                                     size_t frames);
+/** \brief See \ref ebur128_add_frames_strided_short */
+int ebur128_add_frames_strided_int(ebur128_state* st,
+                                   const int* src,
+                                   size_t stride,
+                                   size_t frames);
+/** \brief See \ref ebur128_add_frames_strided_short */
+int ebur128_add_frames_strided_float(ebur128_state* st,
+                                     const float* src,
+                                     size_t stride,
+                                     size_t frames);
+/** \brief See \ref ebur128_add_frames_strided_short */
+int ebur128_add_frames_strided_double(ebur128_state* st,
+                                      const double* src,
+                                      size_t stride,
+                                      size_t frames);
+
+/** \brief Add interleaved frames in a packed or foreign-endian format.
+ *
+ *  Same as \ref ebur128_add_frames_short, but reads the samples in the layout
+ *  they are stored in files, so no converted copy of the audio is needed:
+ *    - u8: unsigned 8 bit, 0x80 is silence.
+ *    - s16be: signed 16 bit, big endian.
+ *    - s24le: signed 24 bit packed into 3 bytes, little endian.
+ *    - s24be: signed 24 bit packed into 3 bytes, big endian.
+ *    - s24in32: signed 24 bit in the low bits of a native int. The upper 8
+ *      bits are ignored.
+ *    - s32be: signed 32 bit, big endian.
+ *    - f32be: IEEE 754 single precision float, big endian.
+ *
+ *  The byte formats don't need any alignment.
+ *
+ *  @param st library state.
+ *  @param src array of source frames. Channels must be interleaved.
+ *  @param frames number of frames. Not number of samples!
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_NOMEM on memory allocation error.
+ */
+int ebur128_add_frames_u8(ebur128_state* st,
+                          const unsigned char* src,
+                          size_t frames);
+/** \brief See \ref ebur128_add_frames_u8 */
+int ebur128_add_frames_s16be(ebur128_state* st,
+                             const unsigned char* src,
+                             size_t frames);
+/** \brief See \ref ebur128_add_frames_u8 */
+int ebur128_add_frames_s24le(ebur128_state* st,
+                             const unsigned char* src,
+                             size_t frames);
+/** \brief See \ref ebur128_add_frames_u8 */
+int ebur128_add_frames_s24be(ebur128_state* st,
+                             const unsigned char* src,
+                             size_t frames);
+/** \brief See \ref ebur128_add_frames_u8 */
+int ebur128_add_frames_s24in32(ebur128_state* st,
+                               const int* src,
+                               size_t frames);
+/** \brief See \ref ebur128_add_frames_u8 */
+int ebur128_add_frames_s32be(ebur128_state* st,
+                             const unsigned char* src,
+                             size_t frames);
+/** \brief See \ref ebur128_add_frames_u8 */
+int ebur128_add_frames_f32be(ebur128_state* st,
+                             const unsigned char* src,
+                             size_t frames);
+
 /** \brief Get global integrated loudness in LUFS.
  *
  *  @param st library state.
@@ -277,12 +659,17 @@ int ebur128_loudness_shortterm(ebur128_state* st, double* out);
  *  window must not be larger than the current window set in st.
  *  The current window can be changed by calling ebur128_set_max_window().
  *
+ *  Longer windows are allowed up to the duration set with
+ *  ebur128_set_max_long_window(), if they are a multiple of 100ms. They end
+ *  with the last completed 100ms block.
+ *
  *  @param st library state.
  *  @param window window in ms to calculate loudness.
  *  @param out loudness in LUFS. -HUGE_VAL if result is negative infinity.
  *  @return
  *    - EBUR128_SUCCESS on success.
- *    - EBUR128_ERROR_INVALID_MODE if window larger than current window in st.
+ *    - EBUR128_ERROR_INVALID_MODE if window larger than current window in st,
+ *      and not a long window.
  */
 int ebur128_loudness_window(ebur128_state* st,
                             unsigned long window,
@@ -391,6 +778,10 @@ int ebur128_true_peak(ebur128_state* st,
  *
  *  The equation to convert to dBTP is: 20 * log10(out)
  *
+ *  With EBUR128_MODE_TRUE_PEAK_SKIP, audio is only oversampled if it could
+ *  raise the true peak of the last call, so the result is the same as
+ *  without skipping. Many small calls leave less audio to skip.
+ *
  *  @param st library state
  *  @param channel_number channel to analyse
  *  @param out maximum true peak in float format (1.0 is 0 dBTP)
@@ -415,6 +806,286 @@ int ebur128_prev_true_peak(ebur128_state* st,
  */
 int ebur128_relative_threshold(ebur128_state* st, double* out);
 
+/** Number of channels whose peaks are kept in ebur128_snapshot. */
+#define EBUR128_SNAPSHOT_CHANNELS 64
+
+/** \brief Meter values of a state at the end of a 100ms block.
+ *
+ *  Loudness values are in LUFS, and -HUGE_VAL if the mode of the state does
+ *  not provide them, see ebur128_set_snapshot. Peaks are 0.0 if not
+ *  provided, and for channels that the state does not have.
+ */
+typedef struct {
+  unsigned long blocks;      /**< 100ms blocks measured so far. */
+  double momentary;          /**< See ebur128_loudness_momentary. */
+  double shortterm;          /**< See ebur128_loudness_shortterm. */
+  double global;             /**< See ebur128_loudness_global. */
+  double loudness_range;     /**< See ebur128_loudness_range, in LU. */
+  double relative_threshold; /**< See ebur128_relative_threshold. */
+  /** See ebur128_sample_peak. */
+  double sample_peak[EBUR128_SNAPSHOT_CHANNELS];
+  /** See ebur128_true_peak. */
+  double true_peak[EBUR128_SNAPSHOT_CHANNELS];
+} ebur128_snapshot;
+
+/** \brief Publish the meter values of a state for other threads.
+ *
+ *  When enabled, the values are collected at the end of each 100ms block,
+ *  and once right away. Other threads can then read them with
+ *  ebur128_get_snapshot while frames are added, without locking the state.
+ *  The integrated loudness, the loudness range and the relative threshold
+ *  are only collected with EBUR128_MODE_HISTOGRAM or
+ *  EBUR128_MODE_INCREMENTAL, which keep them up to date as blocks are added,
+ *  and are -HUGE_VAL otherwise. With ebur128_set_true_peak_worker, the true
+ *  peaks leave out the few tiles that the worker has not interpolated yet.
+ *
+ *  Enable the snapshot before other threads read it, and disable it only
+ *  after they are done.
+ *
+ *  @param st library state.
+ *  @param enable non-zero to publish the values, zero to stop.
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_NOMEM on memory allocation error.
+ *    - EBUR128_ERROR_NO_CHANGE if the snapshot is already in that state.
+ */
+int ebur128_set_snapshot(ebur128_state* st, int enable);
+
+/** \brief Get the last published meter values.
+ *
+ *  Can be called from any number of threads while another one adds frames.
+ *  Readers never block the writer, but they are not wait-free: a reader
+ *  that overlaps the publishing of a block retries its copy, and spins
+ *  while a write is in progress.
+ *
+ *  @param st library state.
+ *  @param out the values of the last completed 100ms block.
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_INVALID_MODE if the snapshot is not enabled.
+ */
+int ebur128_get_snapshot(const ebur128_state* st, ebur128_snapshot* out);
+
+/** \brief Get the size of shared memory for the meter values of several
+ *         streams.
+ *
+ *  The meter values of states can be published to memory that is shared
+ *  with other processes, e.g. a file or shared memory object that all of
+ *  them map. Each state writes to its own slot at the end of each 100ms
+ *  block, and readers in any process get the values with
+ *  ebur128_get_shared, without locks or system calls. The layout is the same
+ *  for 32 and 64 bit processes. It has a version, and is only used by
+ *  processes that use the same one.
+ *
+ *  @param streams number of slots.
+ *  @return the size in bytes.
+ */
+size_t ebur128_shared_size(unsigned int streams);
+
+/** \brief Set up shared memory for the meter values of several streams.
+ *
+ *  Call this once, in one process, before any state or reader uses the
+ *  memory.
+ *
+ *  @param memory at least ebur128_shared_size(streams) bytes, aligned like
+ *         a double.
+ *  @param streams number of slots.
+ */
+void ebur128_shared_init(void* memory, unsigned int streams);
+
+/** \brief Publish the meter values of a state to shared memory.
+ *
+ *  The values are the ones of ebur128_set_snapshot. They are written at the
+ *  end of each 100ms block, and once right away. Only one state may write to
+ *  each slot.
+ *
+ *  @param st library state.
+ *  @param memory shared memory set up with ebur128_shared_init, or NULL to
+ *         stop publishing.
+ *  @param stream the slot to write to.
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_INVALID_MODE if the memory has a different layout, or
+ *      no such slot.
+ */
+int ebur128_set_shared(ebur128_state* st, void* memory, unsigned int stream);
+
+/** \brief Get the meter values of a stream from shared memory.
+ *
+ *  Can be called from any number of threads and processes. Like
+ *  ebur128_get_snapshot, it retries while the slot is written.
+ *
+ *  @param memory shared memory set up with ebur128_shared_init.
+ *  @param stream the slot to read.
+ *  @param out the values of the last completed 100ms block of the stream.
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_INVALID_MODE if the memory has a different layout, or
+ *      no such slot.
+ */
+int ebur128_get_shared(const void* memory,
+                       unsigned int stream,
+                       ebur128_snapshot* out);
+
+/** \brief A completed 100ms block, see ebur128_set_block_callback.
+ *
+ *  Energies are mean squares of the weighted channels. A loudness in LUFS
+ *  is 10 * log10(energy) - 0.691, or -HUGE_VAL for an energy of 0.0.
+ */
+typedef struct {
+  unsigned long index; /**< Position of the block in the stream. */
+  double momentary;    /**< Energy of the last 400ms. */
+  /** Energy of the last 3s, 0.0 if "EBUR128_MODE_S" has not been set. */
+  double shortterm;
+  /** Sample peak of each channel in the block, 0.0 if
+   *  "EBUR128_MODE_SAMPLE_PEAK" has not been set. */
+  const double* sample_peak;
+  /** True peak of each channel in the block, 0.0 if
+   *  "EBUR128_MODE_TRUE_PEAK" has not been set. */
+  const double* true_peak;
+} ebur128_block;
+
+/** \brief A function that is called for each completed 100ms block. */
+typedef void (*ebur128_block_callback)(void* user,
+                                       const ebur128_block* block);
+
+/** \brief Get the values of each 100ms block as it is completed.
+ *
+ *  The callback is called from ebur128_add_frames_*, once for each block
+ *  that the frames complete, in order. This is cheaper than adding 100ms of
+ *  frames at a time and asking for the momentary and short term loudness
+ *  after each. The block is only valid during the call, and the callback must
+ *  not use the state.
+ *
+ *  Frames are filtered on the calling thread while the callback is set, even
+ *  with ebur128_set_threads. Channel groups of ebur128_set_channel_parts
+ *  still run in parallel. With ebur128_set_true_peak_worker, a block is
+ *  reported once the worker has interpolated it, later in the same call.
+ *  With "EBUR128_MODE_TRUE_PEAK_SKIP", audio is also oversampled if it could
+ *  raise the true peak of its block.
+ *
+ *  @param st library state.
+ *  @param callback called for each block, or NULL to stop.
+ *  @param user passed to the callback.
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_NOMEM on memory allocation error.
+ */
+int ebur128_set_block_callback(ebur128_state* st,
+                               ebur128_block_callback callback,
+                               void* user);
+
+/** \brief Record the momentary and short term loudness while measuring.
+ *
+ *  A point is added at the end of every "hop" 100ms blocks, counted from the
+ *  start of the stream. Each point is two floats, the momentary and the
+ *  short term loudness in LUFS at the end of its last block, as given by
+ *  ebur128_loudness_momentary and ebur128_loudness_shortterm. Values that
+ *  the mode does not provide are -HUGE_VAL. Recording costs the same for
+ *  every block, whatever the length of the stream.
+ *
+ *  Setting a new timeline discards the points of the previous one.
+ *
+ *  @param st library state.
+ *  @param hop blocks per point, e.g. 1 for 100ms or 10 for 1s. Zero stops
+ *         recording.
+ *  @param points caller buffer for "size" points, i.e. 2 * size floats.
+ *         Points that do not fit are dropped. If NULL, the library
+ *         allocates the points and grows them as needed.
+ *  @param size number of points that fit in the caller buffer.
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_NOMEM on memory allocation error.
+ */
+int ebur128_set_timeline(ebur128_state* st,
+                         unsigned int hop,
+                         float* points,
+                         size_t size);
+
+/** \brief Get the recorded timeline.
+ *
+ *  @param st library state.
+ *  @param points set to the points, two floats each. They stay valid until
+ *         more frames are added, or the timeline is set again.
+ *  @return the number of points, 0 if no timeline is recorded.
+ */
+size_t ebur128_get_timeline(const ebur128_state* st, const float** points);
+
+/** \brief Measures a state on its own analysis thread.
+ *
+ *  For real-time threads, which must not wait for locks or the allocator.
+ *  The audio thread only copies frames into a ring buffer with
+ *  ebur128_offload_add_frames_float, which is wait-free. The analysis thread
+ *  sleeps until frames arrive, adds them to the state, which publishes its
+ *  values as with ebur128_set_snapshot.
+ *
+ *  If the snapshot of the state is not enabled yet, the offload enables it,
+ *  together with EBUR128_MODE_INCREMENTAL unless the state uses
+ *  EBUR128_MODE_HISTOGRAM, so that the integrated loudness, loudness range
+ *  and relative threshold are published as well. Both are turned off again
+ *  by ebur128_offload_destroy.
+ *
+ *  While the offload exists, the state must not be used otherwise, apart from
+ *  ebur128_get_snapshot.
+ */
+typedef struct ebur128_offload ebur128_offload;
+
+/** \brief Start measuring a state on an analysis thread.
+ *
+ *  @param st library state, with the channels of the frames to add.
+ *  @param frames size of the ring buffer in frames. It should hold the
+ *         frames of several periods of the audio thread.
+ *  @return the offload, or NULL on errors.
+ */
+ebur128_offload* ebur128_offload_create(ebur128_state* st, size_t frames);
+
+/** \brief Stop the analysis thread.
+ *
+ *  The frames in the ring buffer are added to the state first. The state
+ *  can then be used and destroyed as usual.
+ *
+ *  @param offload pointer to an offload, which will be set to NULL.
+ */
+void ebur128_offload_destroy(ebur128_offload** offload);
+
+/** \brief Copy frames into the ring buffer.
+ *
+ *  Only one thread at a time may add frames. Frames that do not fit into the
+ *  ring buffer are dropped, see ebur128_offload_overruns.
+ *
+ *  @param offload the offload.
+ *  @param src array of source frames. Channels must be interleaved.
+ *  @param frames number of frames. Not number of samples!
+ *  @return EBUR128_SUCCESS.
+ */
+int ebur128_offload_add_frames_float(ebur128_offload* offload,
+                                     const float* src,
+                                     size_t frames);
+
+/** \brief Get the number of frames that were dropped because the ring
+ *         buffer was full.
+ *
+ *  @param offload the offload.
+ *  @return the number of dropped frames.
+ */
+unsigned long ebur128_offload_overruns(ebur128_offload* offload);
+
+/** \brief Get the latest meter values.
+ *
+ *  Can be called from any number of threads, without locks. The values
+ *  include the integrated loudness, see ebur128_offload.
+ *
+ *  @param offload the offload.
+ *  @param out the values of the last completed 100ms block.
+ *  @return
+ *    - EBUR128_SUCCESS on success.
+ *    - EBUR128_ERROR_NOMEM if the analysis thread failed to add frames, in
+ *      which case the values are not reliable.
+ *    - EBUR128_ERROR_INVALID_MODE if the snapshot of the state was turned
+ *      off.
+ */
+int ebur128_offload_snapshot(ebur128_offload* offload, ebur128_snapshot* out);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,95 @@
+/* See COPYING file for copyright and license details. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ebur128.h"
+
+#define SAMPLERATE 48000
+/* each measurement runs for at least this much CPU time */
+#define MIN_SECONDS 0.5
+
+static const unsigned int channel_counts[] = { 1,  2,  4,  6,  8,
+                                               12, 16, 24, 32, 64 };
+
+static double
+measure(unsigned int channels, int mode, int planar, const float* buffer) {
+  const float* planes[64];
+  ebur128_state* st;
+  unsigned int c;
+  size_t frames = 0;
+  clock_t start, elapsed;
+  double seconds;
+
+  st = ebur128_init(channels, SAMPLERATE, mode);
+  if (!st) {
+    fprintf(stderr, "Could not create ebur128_state!\n");
+    exit(1);
+  }
+  /* the default channel map leaves most channels of wide layouts unused */
+  for (c = 0; c < channels; ++c) {
+    ebur128_set_channel(st, c, EBUR128_LEFT);
+    planes[c] = buffer + c * SAMPLERATE;
+  }
+
+  start = clock();
+  do {
+    if (planar ? ebur128_add_frames_planar_float(st, planes, SAMPLERATE)
+               : ebur128_add_frames_float(st, buffer, SAMPLERATE)) {
+      fprintf(stderr, "ebur128_add_frames failed\n");
+      exit(1);
+    }
+    frames += SAMPLERATE;
+    elapsed = clock() - start;
+  } while ((double) elapsed < MIN_SECONDS * CLOCKS_PER_SEC);
+  seconds = (double) elapsed / CLOCKS_PER_SEC;
+
+  ebur128_destroy(&st);
+  return (double) frames / seconds;
+}
+
+int main(int ac, const char* av[]) {
+  int mode = EBUR128_MODE_I;
+  int planar = 0;
+  float* buffer;
+  size_t i, c;
+  unsigned int max_channels = 64;
+
+  for (i = 1; i < (size_t) ac; ++i) {
+    if (!strcmp(av[i], "true-peak")) {
+      mode |= EBUR128_MODE_TRUE_PEAK;
+    } else if (!strcmp(av[i], "true-peak-skip")) {
+      mode |= EBUR128_MODE_TRUE_PEAK_SKIP;
+    } else if (!strcmp(av[i], "lra")) {
+      mode |= EBUR128_MODE_LRA;
+    } else if (!strcmp(av[i], "planar")) {
+      planar = 1;
+    } else {
+      fprintf(stderr, "usage: %s [true-peak|true-peak-skip] [lra] [planar]\n",
+              av[0]);
+      return 1;
+    }
+  }
+
+  /* one second of noise for the widest layout */
+  buffer = (float*) malloc(SAMPLERATE * max_channels * sizeof(float));
+  if (!buffer) {
+    fprintf(stderr, "malloc failed\n");
+    return 1;
+  }
+  srand(1);
+  for (i = 0; i < SAMPLERATE * max_channels; ++i) {
+    buffer[i] = (float) rand() / (float) RAND_MAX - 0.5f;
+  }
+
+  printf("%8s %16s %12s\n", "channels", "frames/s", "realtime");
+  for (c = 0; c < sizeof(channel_counts) / sizeof(channel_counts[0]); ++c) {
+    double fps = measure(channel_counts[c], mode, planar, buffer);
+    printf("%8u %16.0f %11.1fx\n", channel_counts[c], fps, fps / SAMPLERATE);
+  }
+
+  free(buffer);
+  return 0;
+}
@@ -2,9 +2,15 @@
 
 #include <math.h>
 #include <sndfile.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
 #include "ebur128.h"
 
 double test_global_loudness(const char* filename, ebur128_state** out_state) {
@@ -243,6 +249,1066 @@ double test_max_shortterm(const char* filename) {
   return max_shortterm;
 }
 
+/* The tests below don't need any files. They feed noise whose level changes
+ * every half second, so that gating and loudness range have something to do,
+ * and compare the results of different ways of getting there. */
+void fill_noise(float* buffer,
+                size_t frames,
+                unsigned channels,
+                unsigned long samplerate,
+                unsigned long start) {
+  size_t i;
+  unsigned c;
+
+  for (i = 0; i < frames; ++i) {
+    unsigned long frame = start + (unsigned long) i;
+    double level = 0.02 + 0.1 * (double) (frame / (samplerate / 2) % 9);
+    for (c = 0; c < channels; ++c) {
+      unsigned long x = (frame * channels + c + 1) * 2654435761UL;
+      x &= 0xffffffffUL;
+      x ^= x >> 15;
+      x = (x * 2246822519UL) & 0xffffffffUL;
+      x ^= x >> 13;
+      buffer[i * channels + c] =
+          (float) (level * ((double) x / 2147483648.0 - 1.0));
+    }
+  }
+}
+
+/* Adds the frames of the noise from "start" on, in calls of "chunk"
+ * frames. */
+int add_noise(ebur128_state* st,
+              unsigned long start,
+              size_t frames,
+              size_t chunk) {
+  size_t done = 0;
+  float* buffer = (float*) malloc(chunk * st->channels * sizeof(float));
+  int result = EBUR128_SUCCESS;
+
+  if (!buffer) {
+    return EBUR128_ERROR_NOMEM;
+  }
+  while (done < frames && result == EBUR128_SUCCESS) {
+    size_t n = frames - done < chunk ? frames - done : chunk;
+    fill_noise(buffer, n, st->channels, st->samplerate,
+               start + (unsigned long) done);
+    result = ebur128_add_frames_float(st, buffer, n);
+    done += n;
+  }
+  free(buffer);
+  return result;
+}
+
+int close_to(double a, double b, double epsilon) {
+  if (a == b) {
+    return 1;
+  }
+  return fabs(a - b) <= epsilon;
+}
+
+/* Destroys the states that were created. */
+void destroy_states(ebur128_state** st, size_t count) {
+  size_t k;
+
+  for (k = 0; k < count; ++k) {
+    if (st[k]) {
+      ebur128_destroy(&st[k]);
+    }
+  }
+}
+
+/* Compares the loudness and peaks of two states fed the same audio through
+ * different entry points, which must agree exactly. */
+int same_results(ebur128_state* a, ebur128_state* b) {
+  double x, y;
+  unsigned int c;
+  int ok;
+
+  ok = ebur128_loudness_global(a, &x) == EBUR128_SUCCESS &&
+       ebur128_loudness_global(b, &y) == EBUR128_SUCCESS && x == y &&
+       ebur128_loudness_momentary(a, &x) == EBUR128_SUCCESS &&
+       ebur128_loudness_momentary(b, &y) == EBUR128_SUCCESS && x == y;
+  for (c = 0; ok && c < a->channels; ++c) {
+    ok = ebur128_sample_peak(a, c, &x) == EBUR128_SUCCESS &&
+         ebur128_sample_peak(b, c, &y) == EBUR128_SUCCESS && x == y &&
+         ebur128_true_peak(a, c, &x) == EBUR128_SUCCESS &&
+         ebur128_true_peak(b, c, &y) == EBUR128_SUCCESS && x == y;
+  }
+  return ok;
+}
+
+int test_planar(void) {
+  size_t frames = 48000 * 2, i;
+  float* interleaved = (float*) malloc(frames * 2 * sizeof(float));
+  float* planes = (float*) malloc(frames * 2 * sizeof(float));
+  const float* src[2];
+  ebur128_state* st[2];
+  int ok;
+
+  st[0] = ebur128_init(2, 48000, EBUR128_MODE_I | EBUR128_MODE_TRUE_PEAK);
+  st[1] = ebur128_init(2, 48000, EBUR128_MODE_I | EBUR128_MODE_TRUE_PEAK);
+  ok = interleaved && planes && st[0] && st[1];
+  if (ok) {
+    fill_noise(interleaved, frames, 2, 48000, 0);
+    for (i = 0; i < frames; ++i) {
+      planes[i] = interleaved[2 * i];
+      planes[frames + i] = interleaved[2 * i + 1];
+    }
+  }
+  ok = ok && ebur128_add_frames_float(st[0], interleaved, frames) ==
+                 EBUR128_SUCCESS;
+  /* uneven calls, to cross the internal tiles at odd places */
+  for (i = 0; ok && i < frames; i += 1001) {
+    size_t n = frames - i < 1001 ? frames - i : 1001;
+    src[0] = planes + i;
+    src[1] = planes + frames + i;
+    ok = ebur128_add_frames_planar_float(st[1], src, n) == EBUR128_SUCCESS;
+  }
+  ok = ok && same_results(st[0], st[1]);
+
+  destroy_states(st, 2);
+  free(interleaved);
+  free(planes);
+  return ok;
+}
+
+/* A stereo program on channels 3 and 4 of a six channel buffer must
+ * measure like the same program copied out. */
+int test_strided(void) {
+  size_t frames = 48000 * 2, i;
+  float* wide = (float*) malloc(frames * 6 * sizeof(float));
+  float* stereo = (float*) malloc(frames * 2 * sizeof(float));
+  ebur128_state* st[2];
+  int ok;
+
+  st[0] = ebur128_init(2, 48000, EBUR128_MODE_I | EBUR128_MODE_TRUE_PEAK);
+  st[1] = ebur128_init(2, 48000, EBUR128_MODE_I | EBUR128_MODE_TRUE_PEAK);
+  ok = wide && stereo && st[0] && st[1];
+  if (ok) {
+    fill_noise(wide, frames, 6, 48000, 0);
+    for (i = 0; i < frames; ++i) {
+      stereo[2 * i] = wide[6 * i + 3];
+      stereo[2 * i + 1] = wide[6 * i + 4];
+    }
+  }
+  ok = ok &&
+       ebur128_add_frames_float(st[0], stereo, frames) == EBUR128_SUCCESS;
+  for (i = 0; ok && i < frames; i += 1001) {
+    size_t n = frames - i < 1001 ? frames - i : 1001;
+    ok = ebur128_add_frames_strided_float(st[1], wide + 6 * i + 3, 6, n) ==
+         EBUR128_SUCCESS;
+  }
+  ok = ok && same_results(st[0], st[1]);
+
+  destroy_states(st, 2);
+  free(wide);
+  free(stereo);
+  return ok;
+}
+
+/* Stores the low "bytes" bytes of v, most significant first. */
+void put_be(unsigned char* p, unsigned long v, int bytes) {
+  int k;
+
+  for (k = bytes - 1; k >= 0; --k) {
+    p[k] = (unsigned char) (v & 0xff);
+    v >>= 8;
+  }
+}
+
+/* Each packed format must measure like the native type holding the same
+ * values. */
+int test_packed(void) {
+  size_t frames = 48000 * 2, n = 2 * frames, i;
+  float* noise = (float*) malloc(n * sizeof(float));
+  short* s16 = (short*) malloc(n * sizeof(short));
+  int* s32 = (int*) malloc(n * sizeof(int));
+  int* s24in32 = (int*) malloc(n * sizeof(int));
+  float* f32 = (float*) malloc(n * sizeof(float));
+  unsigned char* bytes = (unsigned char*) malloc(n * 4);
+  ebur128_state* st[2];
+  int format, ok;
+
+  ok = noise && s16 && s32 && s24in32 && f32 && bytes;
+  if (ok) {
+    fill_noise(noise, frames, 2, 48000, 0);
+  }
+  for (format = 0; ok && format < 7; ++format) {
+    st[0] = ebur128_init(2, 48000, EBUR128_MODE_I | EBUR128_MODE_TRUE_PEAK);
+    st[1] = ebur128_init(2, 48000, EBUR128_MODE_I | EBUR128_MODE_TRUE_PEAK);
+    if (!st[0] || !st[1]) {
+      destroy_states(st, 2);
+      ok = 0;
+      break;
+    }
+    for (i = 0; i < n; ++i) {
+      long v8 = (long) (noise[i] * 127.0);
+      long v16 = (long) (noise[i] * 32767.0);
+      long v24 = (long) (noise[i] * 8388607.0);
+      long v32 = (long) (noise[i] * 2147483647.0);
+      unsigned int bits;
+
+      switch (format) {
+        case 0:
+          bytes[i] = (unsigned char) (v8 + 0x80);
+          s16[i] = (short) (v8 * 256);
+          break;
+        case 1:
+          put_be(bytes + 2 * i, (unsigned long) v16, 2);
+          s16[i] = (short) v16;
+          break;
+        case 2:
+          put_be(bytes + 3 * i, (unsigned long) v24, 3);
+          /* little endian */
+          bits = bytes[3 * i];
+          bytes[3 * i] = bytes[3 * i + 2];
+          bytes[3 * i + 2] = (unsigned char) bits;
+          s32[i] = (int) (v24 * 256);
+          break;
+        case 3:
+          put_be(bytes + 3 * i, (unsigned long) v24, 3);
+          s32[i] = (int) (v24 * 256);
+          break;
+        case 4:
+          /* the upper byte must be ignored */
+          s24in32[i] =
+              (int) (((unsigned long) v24 & 0xffffffUL) | 0x5a000000UL);
+          s32[i] = (int) (v24 * 256);
+          break;
+        case 5:
+          put_be(bytes + 4 * i, (unsigned long) v32, 4);
+          s32[i] = (int) v32;
+          break;
+        default:
+          memcpy(&bits, &noise[i], 4);
+          put_be(bytes + 4 * i, bits, 4);
+          f32[i] = noise[i];
+          break;
+      }
+    }
+    switch (format) {
+      case 0:
+        ok = ebur128_add_frames_short(st[0], s16, frames) == EBUR128_SUCCESS &&
+             ebur128_add_frames_u8(st[1], bytes, frames) == EBUR128_SUCCESS;
+        break;
+      case 1:
+        ok = ebur128_add_frames_short(st[0], s16, frames) == EBUR128_SUCCESS &&
+             ebur128_add_frames_s16be(st[1], bytes, frames) == EBUR128_SUCCESS;
+        break;
+      case 2:
+        ok = ebur128_add_frames_int(st[0], s32, frames) == EBUR128_SUCCESS &&
+             ebur128_add_frames_s24le(st[1], bytes, frames) == EBUR128_SUCCESS;
+        break;
+      case 3:
+        ok = ebur128_add_frames_int(st[0], s32, frames) == EBUR128_SUCCESS &&
+             ebur128_add_frames_s24be(st[1], bytes, frames) == EBUR128_SUCCESS;
+        break;
+      case 4:
+        ok = ebur128_add_frames_int(st[0], s32, frames) == EBUR128_SUCCESS &&
+             ebur128_add_frames_s24in32(st[1], s24in32, frames) ==
+                 EBUR128_SUCCESS;
+        break;
+      case 5:
+        ok = ebur128_add_frames_int(st[0], s32, frames) == EBUR128_SUCCESS &&
+             ebur128_add_frames_s32be(st[1], bytes, frames) == EBUR128_SUCCESS;
+        break;
+      default:
+        ok = ebur128_add_frames_float(st[0], f32, frames) == EBUR128_SUCCESS &&
+             ebur128_add_frames_f32be(st[1], bytes, frames) == EBUR128_SUCCESS;
+        break;
+    }
+    ok = ok && same_results(st[0], st[1]);
+    ebur128_destroy(&st[0]);
+    ebur128_destroy(&st[1]);
+  }
+
+  free(noise);
+  free(s16);
+  free(s32);
+  free(s24in32);
+  free(f32);
+  free(bytes);
+  return ok;
+}
+
+/* The true peak worker must not change any result, also when queried,
+ * stopped and restarted in the middle of the stream. */
+int test_true_peak_worker(void) {
+  ebur128_state* st[2];
+  double a, b;
+  unsigned int c;
+  size_t k, second;
+  int ok;
+
+  for (k = 0; k < 2; ++k) {
+    st[k] = ebur128_init(2, 48000, EBUR128_MODE_I | EBUR128_MODE_TRUE_PEAK);
+    if (!st[k]) {
+      return 0;
+    }
+  }
+  ok = ebur128_set_true_peak_worker(st[1], 1) == EBUR128_SUCCESS &&
+       ebur128_set_true_peak_worker(st[1], 1) == EBUR128_ERROR_NO_CHANGE;
+  for (second = 0; ok && second < 6; ++second) {
+    for (k = 0; k < 2; ++k) {
+      ok = ok && add_noise(st[k], (unsigned long) second * 48000, 48000,
+                           1001) == EBUR128_SUCCESS;
+    }
+    for (c = 0; ok && c < 2; ++c) {
+      ok = ebur128_prev_true_peak(st[0], c, &a) == EBUR128_SUCCESS &&
+           ebur128_prev_true_peak(st[1], c, &b) == EBUR128_SUCCESS && a == b;
+    }
+    if (second == 3) {
+      ok = ok && ebur128_set_true_peak_worker(st[1], 0) == EBUR128_SUCCESS;
+    } else if (second == 4) {
+      ok = ok && ebur128_set_true_peak_worker(st[1], 1) == EBUR128_SUCCESS;
+    }
+  }
+  ok = ok && same_results(st[0], st[1]);
+
+  ebur128_destroy(&st[0]);
+  ebur128_destroy(&st[1]);
+  return ok;
+}
+
+/* Queries of an incremental state between calls must match a plain one. */
+int test_incremental(void) {
+  ebur128_state* st[2];
+  double a[3], b[3];
+  size_t k, second;
+  int ok = 1;
+
+  st[0] = ebur128_init(2, 48000, EBUR128_MODE_I | EBUR128_MODE_LRA);
+  st[1] = ebur128_init(2, 48000,
+                       EBUR128_MODE_I | EBUR128_MODE_LRA |
+                           EBUR128_MODE_INCREMENTAL);
+  if (!st[0] || !st[1]) {
+    return 0;
+  }
+  for (second = 0; ok && second < 60; ++second) {
+    for (k = 0; k < 2; ++k) {
+      ok = ok && add_noise(st[k], (unsigned long) second * 48000, 48000,
+                           4800) == EBUR128_SUCCESS;
+      ebur128_loudness_global(st[k], k ? &b[0] : &a[0]);
+      ebur128_relative_threshold(st[k], k ? &b[1] : &a[1]);
+      ebur128_loudness_range(st[k], k ? &b[2] : &a[2]);
+    }
+    for (k = 0; k < 3; ++k) {
+      ok = ok && close_to(a[k], b[k], 1e-9);
+    }
+  }
+
+  ebur128_destroy(&st[0]);
+  ebur128_destroy(&st[1]);
+  return ok;
+}
+
+int test_non_finite_energies(void) {
+  ebur128_state* st[2];
+  double* buffer;
+  double loudness[2];
+  size_t i, k;
+  int ok = 1;
+
+  st[0] = ebur128_init(1, 48000, EBUR128_MODE_I | EBUR128_MODE_INCREMENTAL);
+  st[1] = ebur128_init(1, 48000, EBUR128_MODE_I);
+  buffer = (double*) malloc(48000 * sizeof(double));
+  if (!st[0] || !st[1] || !buffer) {
+    return 0;
+  }
+  for (k = 0; k < 2; ++k) {
+    ebur128_set_max_history(st[k], 3000);
+    /* the energies of these blocks overflow to infinity */
+    for (i = 0; i < 48000; ++i) {
+      buffer[i] = i % 2 ? 1e160 : -1e160;
+    }
+    ebur128_add_frames_double(st[k], buffer, 48000);
+    /* until they have left the history */
+    for (i = 0; i < 48000; ++i) {
+      buffer[i] = i % 2 ? 0.1 : -0.1;
+    }
+    for (i = 0; i < 5; ++i) {
+      ebur128_add_frames_double(st[k], buffer, 48000);
+    }
+    ok = ok && ebur128_loudness_global(st[k], &loudness[k]) == 0 &&
+         loudness[k] > -70.0 && loudness[k] < 0.0;
+  }
+  ok = ok && close_to(loudness[0], loudness[1], 1e-9);
+
+  ebur128_destroy(&st[0]);
+  ebur128_destroy(&st[1]);
+  free(buffer);
+  return ok;
+}
+
+struct block_peaks {
+  size_t count;
+  double momentary;
+  double sample_peak[200][2];
+  double true_peak[200][2];
+};
+
+void collect_block_peaks(void* user, const ebur128_block* block) {
+  struct block_peaks* peaks = (struct block_peaks*) user;
+  peaks->momentary = block->momentary;
+  if (peaks->count < 200) {
+    peaks->sample_peak[peaks->count][0] = block->sample_peak[0];
+    peaks->sample_peak[peaks->count][1] = block->sample_peak[1];
+    peaks->true_peak[peaks->count][0] = block->true_peak[0];
+    peaks->true_peak[peaks->count][1] = block->true_peak[1];
+    ++peaks->count;
+  }
+}
+
+/* Skipping, the true peak worker and reporting blocks must not change any of
+ * the true peaks. */
+int test_true_peak_skip(void) {
+  static struct block_peaks peaks[5];
+  ebur128_state* st[5];
+  float* buffer;
+  double a, b;
+  size_t i, k, call;
+  int ok = 1;
+
+  buffer = (float*) malloc(4800 * 2 * sizeof(float));
+  for (k = 0; k < 5; ++k) {
+    st[k] = ebur128_init(2, 48000,
+                         k == 0 ? EBUR128_MODE_TRUE_PEAK
+                                : EBUR128_MODE_TRUE_PEAK_SKIP);
+    if (!st[k] || !buffer) {
+      return 0;
+    }
+    peaks[k].count = 0;
+    if (k != 2) {
+      ebur128_set_block_callback(st[k], collect_block_peaks, &peaks[k]);
+    }
+    if (k >= 3) {
+      ebur128_set_true_peak_worker(st[k], 1);
+    }
+  }
+  for (call = 0; call < 100; ++call) {
+    fill_noise(buffer, 4800, 2, 48000, (unsigned long) call * 4800);
+    /* a loud sample lets the rest of the call be skipped */
+    buffer[(call % 7) * 600] = 0.95f;
+    for (k = 0; k < 5; ++k) {
+      ebur128_add_frames_float(st[k], buffer, (call % 3 + 1) * 1600);
+    }
+    for (k = 1; k < 5; ++k) {
+      for (i = 0; i < 2; ++i) {
+        ebur128_prev_true_peak(st[0], (unsigned int) i, &a);
+        ebur128_prev_true_peak(st[k], (unsigned int) i, &b);
+        ok = ok && a == b;
+      }
+      /* blocks are reported by the call that completes them */
+      ok = ok && (k == 2 || peaks[k].count == peaks[0].count);
+    }
+  }
+  for (k = 1; k < 5; ++k) {
+    for (i = 0; i < 2; ++i) {
+      ebur128_true_peak(st[0], (unsigned int) i, &a);
+      ebur128_true_peak(st[k], (unsigned int) i, &b);
+      ok = ok && a == b;
+    }
+    if (k != 2) {
+      ok = ok && peaks[k].count == peaks[0].count &&
+           !memcmp(peaks[k].true_peak, peaks[0].true_peak,
+                   peaks[0].count * sizeof(peaks[0].true_peak[0]));
+    }
+  }
+
+  for (k = 0; k < 5; ++k) {
+    ebur128_destroy(&st[k]);
+  }
+  free(buffer);
+  return ok;
+}
+
+/* Blocks report the loudness of the state, and no true peaks without
+ * EBUR128_MODE_TRUE_PEAK. */
+int test_block_callback(void) {
+  static struct block_peaks peaks;
+  ebur128_state* st =
+      ebur128_init(2, 48000, EBUR128_MODE_S | EBUR128_MODE_SAMPLE_PEAK);
+  double momentary;
+  size_t i;
+  int ok;
+
+  if (!st) {
+    return 0;
+  }
+  peaks.count = 0;
+  ok = ebur128_set_block_callback(st, collect_block_peaks, &peaks) ==
+           EBUR128_SUCCESS &&
+       add_noise(st, 0, 48000 * 2, 1500) == EBUR128_SUCCESS &&
+       peaks.count == 20;
+  ebur128_loudness_momentary(st, &momentary);
+  ok = ok && close_to(10 * log10(peaks.momentary) - 0.691, momentary, 1e-9);
+  for (i = 0; ok && i < peaks.count; ++i) {
+    ok = peaks.sample_peak[i][0] > 0.0 && peaks.sample_peak[i][1] > 0.0 &&
+         peaks.true_peak[i][0] == 0.0 && peaks.true_peak[i][1] == 0.0;
+  }
+
+  ebur128_destroy(&st);
+  return ok;
+}
+
+/* Snapshots publish the values of the getters. Those that go through all
+ * blocks only with EBUR128_MODE_INCREMENTAL or EBUR128_MODE_HISTOGRAM, and
+ * the true peaks of the worker may lag behind. */
+int test_snapshot(void) {
+  static const int modes[3] = {
+    EBUR128_MODE_LRA | EBUR128_MODE_I | EBUR128_MODE_TRUE_PEAK,
+    EBUR128_MODE_LRA | EBUR128_MODE_I | EBUR128_MODE_INCREMENTAL,
+    EBUR128_MODE_LRA | EBUR128_MODE_I | EBUR128_MODE_HISTOGRAM
+  };
+  ebur128_state* st[3];
+  ebur128_snapshot snapshot;
+  double a, b, c;
+  size_t k;
+  int ok = 1;
+
+  for (k = 0; k < 3; ++k) {
+    st[k] = ebur128_init(2, 48000, modes[k]);
+    if (!st[k]) {
+      return 0;
+    }
+    ok = ok && ebur128_set_snapshot(st[k], 1) == EBUR128_SUCCESS &&
+         ebur128_set_snapshot(st[k], 1) == EBUR128_ERROR_NO_CHANGE;
+  }
+  ok = ok && ebur128_set_true_peak_worker(st[0], 1) == EBUR128_SUCCESS;
+  for (k = 0; k < 3; ++k) {
+    ok = ok && add_noise(st[k], 0, 48000 * 8, 2400) == EBUR128_SUCCESS &&
+         ebur128_get_snapshot(st[k], &snapshot) == EBUR128_SUCCESS &&
+         snapshot.blocks == 80;
+    ebur128_loudness_shortterm(st[k], &a);
+    ok = ok && close_to(snapshot.shortterm, a, 1e-9);
+    if (k == 0) {
+      ebur128_true_peak(st[k], 1, &a);
+      ok = ok && snapshot.global == -HUGE_VAL &&
+           snapshot.loudness_range == -HUGE_VAL &&
+           snapshot.true_peak[1] > 0.0 && snapshot.true_peak[1] <= a &&
+           snapshot.true_peak[2] == 0.0;
+    } else {
+      ebur128_loudness_global(st[k], &a);
+      ebur128_loudness_range(st[k], &b);
+      ebur128_relative_threshold(st[k], &c);
+      ok = ok && snapshot.global == a && snapshot.loudness_range == b &&
+           snapshot.relative_threshold == c && snapshot.true_peak[0] == 0.0;
+    }
+  }
+  ok = ok && ebur128_set_snapshot(st[0], 0) == EBUR128_SUCCESS &&
+       ebur128_get_snapshot(st[0], &snapshot) == EBUR128_ERROR_INVALID_MODE;
+
+  for (k = 0; k < 3; ++k) {
+    ebur128_destroy(&st[k]);
+  }
+  return ok;
+}
+
+/* Splitting the input in time only changes the loudness by rounding. The
+ * chunks of 2.1 s have 21 blocks, which do not split evenly on 4 threads. */
+int test_threads(void) {
+  ebur128_state* st[2];
+  double a[6], b[6];
+  unsigned int c;
+  size_t k;
+  int ok;
+
+  for (k = 0; k < 2; ++k) {
+    st[k] = ebur128_init(2, 48000,
+                         EBUR128_MODE_I | EBUR128_MODE_LRA |
+                             EBUR128_MODE_TRUE_PEAK);
+    if (!st[k]) {
+      return 0;
+    }
+  }
+  ok = ebur128_set_threads(st[1], 4) == EBUR128_SUCCESS;
+  for (k = 0; k < 2; ++k) {
+    ok = ok && add_noise(st[k], 0, 48000 * 60, 48000 * 7) == EBUR128_SUCCESS &&
+         add_noise(st[k], 48000 * 60, 48000 * 30, 4800 * 21) ==
+             EBUR128_SUCCESS;
+    ebur128_loudness_global(st[k], k ? &b[0] : &a[0]);
+    ebur128_loudness_range(st[k], k ? &b[1] : &a[1]);
+    ebur128_loudness_momentary(st[k], k ? &b[2] : &a[2]);
+    ebur128_loudness_shortterm(st[k], k ? &b[3] : &a[3]);
+  }
+  for (k = 0; k < 4; ++k) {
+    ok = ok && close_to(a[k], b[k], 1e-10);
+  }
+  for (c = 0; c < 2; ++c) {
+    ebur128_sample_peak(st[0], c, &a[4]);
+    ebur128_sample_peak(st[1], c, &b[4]);
+    ebur128_true_peak(st[0], c, &a[5]);
+    ebur128_true_peak(st[1], c, &b[5]);
+    ok = ok && a[4] == b[4] && a[5] == b[5];
+  }
+
+  ebur128_destroy(&st[0]);
+  ebur128_destroy(&st[1]);
+  return ok;
+}
+
+/* Three stereo streams of a batch must measure like three separate
+ * states, including the peaks of blocks and snapshots. */
+int test_batch(void) {
+  static struct block_peaks peaks[6];
+  int mode = EBUR128_MODE_I | EBUR128_MODE_LRA | EBUR128_MODE_TRUE_PEAK;
+  ebur128_batch* batch = ebur128_batch_init(3, 2, 48000, mode);
+  ebur128_state* st[6];
+  ebur128_snapshot snapshot[2];
+  float* buffer[3];
+  const float* src[3];
+  double a, b;
+  size_t i, k, call;
+  int ok = batch != NULL;
+
+  for (k = 0; k < 3; ++k) {
+    buffer[k] = (float*) malloc(3000 * 2 * sizeof(float));
+    src[k] = buffer[k];
+    st[k] = batch ? ebur128_batch_state(batch, (unsigned int) k) : NULL;
+    st[k + 3] = ebur128_init(2, 48000, mode);
+    if (!buffer[k] || !st[k] || !st[k + 3]) {
+      return 0;
+    }
+  }
+  for (k = 0; k < 6; ++k) {
+    peaks[k].count = 0;
+    ok = ok &&
+         ebur128_set_block_callback(st[k], collect_block_peaks, &peaks[k]) ==
+             EBUR128_SUCCESS &&
+         ebur128_set_snapshot(st[k], 1) == EBUR128_SUCCESS;
+  }
+  for (call = 0; call < 64; ++call) {
+    size_t n = (call % 3 + 1) * 1000;
+    for (k = 0; k < 3; ++k) {
+      fill_noise(buffer[k], n, 2, 48000,
+                 (unsigned long) (k * 1000000 + call * 2000));
+      buffer[k][(call * 7 + k) % n * 2] = 0.9f - 0.1f * (float) (call % 5);
+      ebur128_add_frames_float(st[k + 3], buffer[k], n);
+    }
+    ebur128_batch_add_frames_float(batch, src, n);
+    for (k = 0; k < 3; ++k) {
+      ebur128_get_snapshot(st[k], &snapshot[0]);
+      ebur128_get_snapshot(st[k + 3], &snapshot[1]);
+      ok = ok && snapshot[0].blocks == snapshot[1].blocks &&
+           snapshot[0].true_peak[1] == snapshot[1].true_peak[1] &&
+           snapshot[0].sample_peak[0] == snapshot[1].sample_peak[0];
+    }
+  }
+  for (k = 0; k < 3; ++k) {
+    ebur128_loudness_global(st[k], &a);
+    ebur128_loudness_global(st[k + 3], &b);
+    ok = ok && close_to(a, b, 1e-9);
+    ebur128_loudness_range(st[k], &a);
+    ebur128_loudness_range(st[k + 3], &b);
+    ok = ok && close_to(a, b, 1e-9);
+    ebur128_true_peak(st[k], 0, &a);
+    ebur128_true_peak(st[k + 3], 0, &b);
+    ok = ok && a == b && peaks[k].count == 26 &&
+         peaks[k + 3].count == peaks[k].count;
+    for (i = 0; ok && i < peaks[k].count; ++i) {
+      ok = peaks[k].sample_peak[i][0] == peaks[k + 3].sample_peak[i][0] &&
+           peaks[k].true_peak[i][1] == peaks[k + 3].true_peak[i][1];
+    }
+  }
+
+  for (k = 0; k < 3; ++k) {
+    ebur128_destroy(&st[k + 3]);
+    free(buffer[k]);
+  }
+  ebur128_batch_destroy(&batch);
+  return ok;
+}
+
+/* Runs the tasks one after the other and counts them. */
+void run_counted(void* user, ebur128_task task, void* arg, unsigned int count) {
+  unsigned int i;
+  *(unsigned int*) user = count;
+  for (i = 0; i < count; ++i) {
+    task(arg, i);
+  }
+}
+
+/* Channel parts must give the same results as a single task, and as many
+ * parts as requested: 48 channels are split into 3 parts of 16, 5 parts of
+ * 9 or 10, and one part per channel. */
+int test_channel_parts(void) {
+  int mode = EBUR128_MODE_I | EBUR128_MODE_TRUE_PEAK;
+  ebur128_state* st[4];
+  unsigned int tasks[2] = { 0, 0 };
+  double a, b;
+  unsigned int c;
+  size_t k;
+  int ok = 1;
+
+  for (k = 0; k < 4; ++k) {
+    st[k] = ebur128_init(48, 48000, mode);
+    if (!st[k]) {
+      return 0;
+    }
+  }
+  ok = ebur128_set_channel_parts(st[1], 3, run_counted, &tasks[0]) == 0 &&
+       ebur128_set_channel_parts(st[2], 5, run_counted, &tasks[1]) == 0 &&
+       ebur128_set_channel_parts(st[3], 64, NULL, NULL) == 0;
+  for (k = 0; k < 4; ++k) {
+    ok = ok && add_noise(st[k], 0, 48000 * 3, 4000) == EBUR128_SUCCESS;
+  }
+  ok = ok && tasks[0] == 3 && tasks[1] == 5;
+  ebur128_loudness_global(st[0], &a);
+  for (k = 1; k < 4; ++k) {
+    ebur128_loudness_global(st[k], &b);
+    ok = ok && a == b;
+  }
+  for (c = 0; c < 48; ++c) {
+    ebur128_true_peak(st[0], c, &a);
+    for (k = 1; k < 4; ++k) {
+      ebur128_true_peak(st[k], c, &b);
+      ok = ok && a == b;
+    }
+  }
+
+  for (k = 0; k < 4; ++k) {
+    ebur128_destroy(&st[k]);
+  }
+  return ok;
+}
+
+/* Values in shared memory must be those of the snapshot, and memory with
+ * another layout must be refused. */
+int test_shared(void) {
+  ebur128_state* st = ebur128_init(
+      2, 48000,
+      EBUR128_MODE_LRA | EBUR128_MODE_TRUE_PEAK | EBUR128_MODE_HISTOGRAM);
+  double* memory = (double*) malloc(ebur128_shared_size(2));
+  ebur128_snapshot snapshot[2];
+  int ok = 1;
+
+  if (!st || !memory) {
+    return 0;
+  }
+  ebur128_shared_init(memory, 2);
+  ok = memcmp(memory, "EBUR", 4) == 0 &&
+       ebur128_set_snapshot(st, 1) == EBUR128_SUCCESS &&
+       ebur128_set_shared(st, memory, 1) == EBUR128_SUCCESS &&
+       ebur128_set_shared(st, memory, 2) == EBUR128_ERROR_INVALID_MODE &&
+       ebur128_set_shared(st, memory, 1) == EBUR128_SUCCESS &&
+       add_noise(st, 0, 48000 * 5, 3000) == EBUR128_SUCCESS;
+  ok = ok && ebur128_get_snapshot(st, &snapshot[0]) == EBUR128_SUCCESS &&
+       ebur128_get_shared(memory, 1, &snapshot[1]) == EBUR128_SUCCESS &&
+       memcmp(&snapshot[0], &snapshot[1], sizeof(ebur128_snapshot)) == 0 &&
+       snapshot[1].blocks == 50 && snapshot[1].true_peak[1] > 0.0;
+  ok = ok && ebur128_get_shared(memory, 0, &snapshot[1]) == EBUR128_SUCCESS &&
+       snapshot[1].blocks == 0 && snapshot[1].momentary == -HUGE_VAL;
+
+  ((unsigned char*) memory)[0] = 'e';
+  ok = ok && ebur128_get_shared(memory, 1, &snapshot[1]) ==
+                 EBUR128_ERROR_INVALID_MODE;
+
+  ebur128_destroy(&st);
+  free(memory);
+  return ok;
+}
+
+/* An offload on a state without EBUR128_MODE_INCREMENTAL must still
+ * publish the integrated loudness, also of blocks added before it. */
+int test_offload(void) {
+  int mode = EBUR128_MODE_I | EBUR128_MODE_LRA | EBUR128_MODE_TRUE_PEAK;
+  ebur128_state* st[2];
+  ebur128_offload* offload = NULL;
+  ebur128_snapshot snapshot;
+  float buffer[2 * 480];
+  double a, b;
+  unsigned long done, blocks = 0;
+  int ok;
+
+  st[0] = ebur128_init(2, 48000, mode);
+  st[1] = ebur128_init(2, 48000, mode);
+  ok = st[0] && st[1] &&
+       add_noise(st[0], 0, 48000, 4800) == EBUR128_SUCCESS &&
+       add_noise(st[1], 0, 48000 * 6, 4800) == EBUR128_SUCCESS;
+  if (ok) {
+    offload = ebur128_offload_create(st[0], 48000 * 10);
+    ok = offload && (st[0]->mode & EBUR128_MODE_INCREMENTAL);
+  }
+  for (done = 48000; ok && done < 48000 * 6; done += 480) {
+    fill_noise(buffer, 480, 2, 48000, done);
+    ok = ebur128_offload_add_frames_float(offload, buffer, 480) ==
+             EBUR128_SUCCESS &&
+         ebur128_offload_snapshot(offload, &snapshot) == EBUR128_SUCCESS &&
+         snapshot.blocks >= blocks;
+    blocks = snapshot.blocks;
+  }
+  /* wait for the analysis thread to catch up */
+  while (ok && blocks < 60) {
+    ok = ebur128_offload_snapshot(offload, &snapshot) == EBUR128_SUCCESS;
+    blocks = snapshot.blocks;
+  }
+  ok = ok && ebur128_offload_overruns(offload) == 0 &&
+       ebur128_loudness_global(st[1], &a) == EBUR128_SUCCESS &&
+       close_to(snapshot.global, a, 1e-9) &&
+       ebur128_loudness_range(st[1], &b) == EBUR128_SUCCESS &&
+       close_to(snapshot.loudness_range, b, 1e-9);
+  ebur128_offload_destroy(&offload);
+
+  /* the state is left as it was, apart from the frames */
+  ok = ok && offload == NULL && st[0]->mode == mode &&
+       ebur128_get_snapshot(st[0], &snapshot) == EBUR128_ERROR_INVALID_MODE &&
+       same_results(st[0], st[1]);
+
+  destroy_states(st, 2);
+  return ok;
+}
+
+/* Each point of the timeline must hold the momentary and short term
+ * loudness at the end of its block. */
+int test_timeline(void) {
+  ebur128_state* st = ebur128_init(2, 48000, EBUR128_MODE_S);
+  float buffer[2 * 20];
+  const float* points;
+  double expected[2 * 30];
+  size_t k;
+  int ok;
+
+  if (!st) {
+    return 0;
+  }
+  ok = ebur128_set_timeline(st, 1, buffer, 20) == EBUR128_SUCCESS;
+  for (k = 0; ok && k < 30; ++k) {
+    ok = add_noise(st, (unsigned long) k * 4800, 4800, 4800) ==
+             EBUR128_SUCCESS &&
+         ebur128_loudness_momentary(st, &expected[2 * k]) == EBUR128_SUCCESS &&
+         ebur128_loudness_shortterm(st, &expected[2 * k + 1]) ==
+             EBUR128_SUCCESS;
+  }
+  /* points past the caller buffer are dropped */
+  ok = ok && ebur128_get_timeline(st, &points) == 20 && points == buffer;
+  for (k = 0; ok && k < 2 * 20; ++k) {
+    ok = points[k] == (float) expected[k];
+  }
+
+  /* library owned points, one per second */
+  ok = ok && ebur128_set_timeline(st, 10, NULL, 0) == EBUR128_SUCCESS &&
+       ebur128_get_timeline(st, &points) == 0 &&
+       add_noise(st, 48000 * 3, 48000 * 3, 4800) == EBUR128_SUCCESS &&
+       ebur128_get_timeline(st, &points) == 3 &&
+       ebur128_loudness_momentary(st, &expected[0]) == EBUR128_SUCCESS &&
+       points[4] == (float) expected[0];
+
+  ok = ok && ebur128_set_timeline(st, 0, NULL, 0) == EBUR128_SUCCESS &&
+       ebur128_get_timeline(st, &points) == 0;
+
+  ebur128_destroy(&st);
+  return ok;
+}
+
+/* Long windows must match the sum of the energies of their blocks, which
+ * the frame based windows give one by one, also after the ring buffer
+ * wrapped and for quiet windows after loud blocks. */
+int test_long_window(void) {
+  ebur128_state* st = ebur128_init(1, 48000, EBUR128_MODE_M);
+  float* buffer = (float*) malloc(4800 * sizeof(float));
+  double energy[150];
+  double loudness, sum;
+  size_t i, k, blocks;
+  int ok = st && buffer &&
+           ebur128_set_max_long_window(st, 2000) == EBUR128_SUCCESS;
+
+  for (k = 0; ok && k < 150; ++k) {
+    fill_noise(buffer, 4800, 1, 48000, (unsigned long) k * 4800);
+    /* silence the last blocks almost, after loud ones */
+    for (i = 0; k >= 120 && i < 4800; ++i) {
+      buffer[i] *= 1e-5f;
+    }
+    ok = ebur128_add_frames_float(st, buffer, 4800) == EBUR128_SUCCESS &&
+         ebur128_loudness_window(st, 100, &loudness) == EBUR128_SUCCESS;
+    energy[k] = pow(10.0, (loudness + 0.691) / 10.0);
+    for (blocks = 5; ok && blocks <= 20 && blocks <= k + 1; blocks += 5) {
+      sum = 0.0;
+      for (i = 0; i < blocks; ++i) {
+        sum += energy[k - i];
+      }
+      ok = ebur128_loudness_window(st, (unsigned long) blocks * 100,
+                                   &loudness) == EBUR128_SUCCESS &&
+           close_to(loudness, 10.0 * log10(sum / (double) blocks) - 0.691,
+                    1e-9);
+    }
+  }
+  ok = ok && ebur128_loudness_window(st, 2100, &loudness) ==
+                 EBUR128_ERROR_INVALID_MODE;
+
+  if (st) {
+    ebur128_destroy(&st);
+  }
+  free(buffer);
+  return ok;
+}
+
+ebur128_state* merge_test_state(void) {
+  ebur128_state* st = ebur128_init(
+      2, 48000, EBUR128_MODE_I | EBUR128_MODE_LRA | EBUR128_MODE_TRUE_PEAK);
+  if (st && (ebur128_set_timeline(st, 5, NULL, 0) ||
+             ebur128_set_max_long_window(st, 10000))) {
+    ebur128_destroy(&st);
+  }
+  return st;
+}
+
+/* Measures 25s in three chunks, the second of which is too short to hold a
+ * short term block of its own, and compares the merged state with a single
+ * pass. */
+int test_merge(void) {
+  static const unsigned long bounds[4] = { 0, 73, 88, 250 };
+  ebur128_state* whole = merge_test_state();
+  ebur128_state* chunk[3];
+  const float* points[2];
+  size_t used[2];
+  double a, b;
+  size_t i, k;
+  int ok = whole != NULL;
+
+  ok = ok && add_noise(whole, 0, 250 * 4800, 4000) == EBUR128_SUCCESS;
+  for (k = 0; k < 3; ++k) {
+    unsigned long start = bounds[k] * 4800;
+    unsigned long preroll = k ? 48000 : 0;
+    chunk[k] = merge_test_state();
+    ok = ok && chunk[k] &&
+         ebur128_start_chunk(chunk[k], bounds[k], preroll) == 0 &&
+         add_noise(chunk[k], start - preroll,
+                   (bounds[k + 1] - bounds[k]) * 4800 + preroll,
+                   3000) == EBUR128_SUCCESS;
+  }
+  ok = ok && ebur128_merge(chunk[0], chunk[1]) == EBUR128_SUCCESS &&
+       ebur128_merge(chunk[0], chunk[2]) == EBUR128_SUCCESS;
+
+  ok = ok && ebur128_loudness_global(whole, &a) == EBUR128_SUCCESS &&
+       ebur128_loudness_global(chunk[0], &b) == EBUR128_SUCCESS &&
+       close_to(a, b, 1e-9);
+  ok = ok && ebur128_loudness_range(whole, &a) == EBUR128_SUCCESS &&
+       ebur128_loudness_range(chunk[0], &b) == EBUR128_SUCCESS &&
+       close_to(a, b, 1e-9);
+  ok = ok && ebur128_loudness_window(whole, 10000, &a) == EBUR128_SUCCESS &&
+       ebur128_loudness_window(chunk[0], 10000, &b) == EBUR128_SUCCESS &&
+       close_to(a, b, 1e-9);
+  ok = ok && ebur128_true_peak(whole, 1, &a) == EBUR128_SUCCESS &&
+       ebur128_true_peak(chunk[0], 1, &b) == EBUR128_SUCCESS &&
+       close_to(a, b, 1e-9);
+  if (ok) {
+    used[0] = ebur128_get_timeline(whole, &points[0]);
+    used[1] = ebur128_get_timeline(chunk[0], &points[1]);
+    ok = used[0] == 50 && used[1] == used[0];
+  }
+  for (i = 0; ok && i < 2 * used[0]; ++i) {
+    ok = close_to(points[0][i], points[1][i], 1e-4);
+  }
+
+  /* all states need the same timeline */
+  ok = ok && ebur128_set_timeline(chunk[2], 10, NULL, 0) == EBUR128_SUCCESS &&
+       ebur128_merge(chunk[1], chunk[2]) == EBUR128_ERROR_INVALID_MODE;
+
+  destroy_states(&whole, 1);
+  destroy_states(chunk, 3);
+  return ok;
+}
+
+/* Prints the results of one second of noise, which goes through the filter
+ * and the true peak interpolator, for comparing the SIMD levels. All channels
+ * count towards the loudness, unlike with the default channel map. */
+void print_state_digest(FILE* out, unsigned int channels, unsigned long rate) {
+  ebur128_state* st =
+      ebur128_init(channels, rate, EBUR128_MODE_I | EBUR128_MODE_TRUE_PEAK);
+  double value;
+  unsigned int c;
+  int ok = st != NULL;
+
+  for (c = 0; ok && c < channels; ++c) {
+    ok = ebur128_set_channel(st, c, c % 2 ? EBUR128_RIGHT : EBUR128_LEFT) ==
+         EBUR128_SUCCESS;
+  }
+  if (!ok || add_noise(st, 0, rate, 1001) != EBUR128_SUCCESS) {
+    fprintf(out, "error\n");
+  } else {
+    ebur128_loudness_global(st, &value);
+    fprintf(out, "%lu %u: %.17g", rate, channels, value);
+    ebur128_loudness_momentary(st, &value);
+    fprintf(out, " %.17g", value);
+    for (c = 0; c < channels; ++c) {
+      ebur128_sample_peak(st, c, &value);
+      fprintf(out, " %.17g", value);
+      ebur128_true_peak(st, c, &value);
+      fprintf(out, " %.17g", value);
+    }
+    fprintf(out, "\n");
+  }
+  if (st) {
+    ebur128_destroy(&st);
+  }
+}
+
+/* Covers all sample rates and both interpolation factors, and every channel
+ * count up to 24 for the filter tiles and their remainders. */
+void print_digest(FILE* out) {
+  static const unsigned long rates[4] = { 44100, 48000, 96000, 192000 };
+  static const unsigned int channels[3] = { 1, 2, 6 };
+  size_t r, k;
+
+  for (r = 0; r < 4; ++r) {
+    for (k = 0; k < 3; ++k) {
+      print_state_digest(out, channels[k], rates[r]);
+    }
+  }
+  for (k = 1; k <= 24; ++k) {
+    print_state_digest(out, (unsigned int) k, 48000);
+  }
+}
+
+/* Set by main, to run the test program with other SIMD levels. */
+const char* test_program;
+
+/* The digest of this process, which uses the widest SIMD level, must be the
+ * same as the ones of the lower levels, which only take effect in a new
+ * process. */
+int test_simd_level(void) {
+  static const char* const levels[3] = { "none", "sse2", "avx2" };
+  int level = ebur128_get_simd_level();
+  FILE* reference = tmpfile();
+  char* command = (char*) malloc(strlen(test_program) + 64);
+  FILE* child;
+  size_t k;
+  int a, b;
+  int ok = reference && command && level >= EBUR128_SIMD_NONE &&
+           level <= EBUR128_SIMD_AVX512;
+
+  if (ok) {
+    print_digest(reference);
+  }
+  for (k = 0; ok && k < 3; ++k) {
+#ifdef _WIN32
+    sprintf(command, "set EBUR128_SIMD=%s&& \"%s\" --digest", levels[k],
+            test_program);
+#else
+    sprintf(command, "EBUR128_SIMD=%s '%s' --digest", levels[k],
+            test_program);
+#endif
+    child = popen(command, "r");
+    if (!child) {
+      ok = 0;
+      break;
+    }
+    rewind(reference);
+    do {
+      a = fgetc(reference);
+      b = fgetc(child);
+      ok = a == b;
+    } while (ok && a != EOF);
+    ok = pclose(child) == 0 && ok;
+  }
+
+  if (reference) {
+    fclose(reference);
+  }
+  free(command);
+  return ok;
+}
+
 double gr[] = { -23.0, -33.0, -23.0, -23.0, -23.0, -23.0, -23.0, -23.0, -23.0 };
 double gre[] = { -2.2953556442089987e+01, -3.2959860397340044e+01,
                  -2.2995899818255047e+01, -2.3035918615414182e+01,
@@ -254,11 +1320,17 @@ double lrae[] = { 1.0001105488329134e+01, 4.9993734051522178e+00,
                   1.9995064067783115e+01, 1.4999273937723455e+01,
                   4.9747585878473721e+00, 1.4993650849123316e+01 };
 
-int main() {
+int main(int argc, char** argv) {
   double result;
   ebur128_state* states[9] = { 0 };
   int i;
 
+  if (argc > 1 && !strcmp(argv[1], "--digest")) {
+    print_digest(stdout);
+    return 0;
+  }
+  test_program = argv[0];
+
   fprintf(stderr, "Note: the tests do not have to pass with EXACT_PASSED.\n"
                   "Passing these tests does not mean that the library is "
                   "100%% EBU R 128 compliant!\n\n");
@@ -405,5 +1477,27 @@ after_multiple_test:;
   TEST_MAX_SHORTTERM("seq-3341-10-19-24bit.wav", -23.0)
   TEST_MAX_SHORTTERM("seq-3341-10-20-24bit.wav", -23.0)
 
+#define TEST_SYNTHETIC(test, name)                                             \
+  printf("%s, %s\n", test() ? "PASSED" : "FAILED", name);
+
+  TEST_SYNTHETIC(test_non_finite_energies, "non-finite block energies")
+  TEST_SYNTHETIC(test_incremental, "EBUR128_MODE_INCREMENTAL")
+  TEST_SYNTHETIC(test_planar, "ebur128_add_frames_planar_float")
+  TEST_SYNTHETIC(test_packed, "ebur128_add_frames_u8 and friends")
+  TEST_SYNTHETIC(test_strided, "ebur128_add_frames_strided_float")
+  TEST_SYNTHETIC(test_true_peak_worker, "ebur128_set_true_peak_worker")
+  TEST_SYNTHETIC(test_true_peak_skip, "EBUR128_MODE_TRUE_PEAK_SKIP")
+  TEST_SYNTHETIC(test_simd_level, "ebur128_get_simd_level")
+  TEST_SYNTHETIC(test_block_callback, "ebur128_set_block_callback")
+  TEST_SYNTHETIC(test_snapshot, "ebur128_set_snapshot")
+  TEST_SYNTHETIC(test_threads, "ebur128_set_threads")
+  TEST_SYNTHETIC(test_channel_parts, "ebur128_set_channel_parts")
+  TEST_SYNTHETIC(test_merge, "ebur128_merge")
+  TEST_SYNTHETIC(test_timeline, "ebur128_set_timeline")
+  TEST_SYNTHETIC(test_long_window, "ebur128_set_max_long_window")
+  TEST_SYNTHETIC(test_shared, "ebur128_set_shared")
+  TEST_SYNTHETIC(test_offload, "ebur128_offload_create")
+  TEST_SYNTHETIC(test_batch, "ebur128_batch_add_frames_float")
+
   return 0;
 }